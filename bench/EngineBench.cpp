@@ -0,0 +1,603 @@
+/*=========================================================================
+/ James McCormick - EngineBench.cpp
+/ Timings of the Engine core hot paths
+/
+/ Build from the repo root with optimisations on, e.g.
+/	g++ -std=c++11 -O2 -pthread -Iengine bench/EngineBench.cpp engine/[A-Z]*.cpp -o engine_bench
+/
+/ Usage:	engine_bench [--quick] [name filter]
+/ Prints one JSON object per line, one line per benchmark and parameter:
+/	{"bench":"dispatch","param":1000,"ops":1000,"reps":15,"min_ns":..,"median_ns":..,"ops_per_sec":..}
+/ min_ns and median_ns are per operation.  Keep the machine quiet and
+/ compare medians between runs of the same build flags.
+/==========================================================================*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Engine.h"
+#include "MessageRecorder.h"
+
+using namespace engine;
+
+namespace {
+
+bool quick_run = false;
+const char* name_filter = 0;
+
+// Every listener consumes, so nothing is requeued and the queues stay flat
+class BenchListener : public MessageListener {
+public:
+	unsigned long count_;
+	BenchListener() : count_(0) {}
+	bool onMessage(const Message&) { ++count_; return true; }
+};
+
+class BenchSystem : public EngineSystem {
+public:
+	double total_;
+	BenchSystem() : total_(0.0) {}
+	void onRender(const double&) {}
+	void onUpdate(const double& elapsedTime) { total_ += elapsedTime; }
+};
+
+class BenchState : public EngineState {
+public:
+	explicit BenchState(std::size_t systems = 0, bool arena = false) {
+		for (std::size_t i = 0; i < systems; ++i) {
+			if (arena)
+				emplaceSystem<BenchSystem>(UPDATELIST, 0);
+			else
+				pushBackUpdate(std::make_shared<BenchSystem>());
+		}
+	}
+	void enter() {}
+	void exit() {}
+};
+//-----------------------------------------------------------------------
+
+
+//-----------------------------------------------------------------------
+// runBench
+// Description
+//		Times reps calls of body, each doing ops operations, and prints
+//		the per operation times as one JSON line.  body is called once
+//		before the timing starts to warm the pools and caches.
+//
+// Arguments:	name - the benchmark name
+//				param - the size being tested, printed as is
+//				ops - operations per call of body
+//				body - void(), does one rep
+//				between - void(), run untimed after every call of body
+// Returns:		None.
+//-----------------------------------------------------------------------
+template <class Body, class Between>
+void runBench(const char* name, long long param, std::size_t ops, Body body, Between between) {
+	if (name_filter && !std::strstr(name, name_filter))
+		return;
+
+	std::size_t reps = quick_run ? 3 : 15;
+	if (ops >= 100000)
+		reps = quick_run ? 2 : 5;
+
+	body();
+	between();
+	std::vector<long long> times;
+	times.reserve(reps);
+	for (std::size_t r = 0; r < reps; ++r) {
+		long long start = C_Timer::now();
+		body();
+		times.push_back(C_Timer::now() - start);
+		between();
+	}
+	std::sort(times.begin(), times.end());
+
+	double minNs = (double)times.front() / ops;
+	double medianNs = (double)times[times.size() / 2] / ops;
+	std::printf("{\"bench\":\"%s\",\"param\":%lld,\"ops\":%lu,\"reps\":%lu,"
+		"\"min_ns\":%.2f,\"median_ns\":%.2f,\"ops_per_sec\":%.0f}\n",
+		name, param, (unsigned long)ops, (unsigned long)reps,
+		minNs, medianNs, medianNs > 0.0 ? 1e9 / medianNs : 0.0);
+	std::fflush(stdout);
+}
+
+template <class Body>
+void runBench(const char* name, long long param, std::size_t ops, Body body) {
+	runBench(name, param, ops, body, [] {});
+}
+
+
+// Leaves the engine running with an empty state, no listeners and no messages
+Engine& resetEngine() {
+	Engine& e = Engine::instance();
+	e.clean();
+	e.start();
+	e.pushState(std::make_shared<BenchState>());
+	return e;
+}
+
+
+//-----------------------------------------------------------------------
+// Message bus
+void benchQueueDispatch() {
+	const std::size_t sizes[] = { 1000, 10000, 100000, 1000000 };
+	const MessageType TYPES = 8;
+
+	for (auto n : sizes) {
+		if (quick_run && n > 100000)
+			continue;
+
+		Engine& e = resetEngine();
+		for (MessageType t = 0; t < TYPES; ++t)
+			e.addListener(std::make_shared<BenchListener>(), t);
+
+		// Queueing alone, the tick that empties the queue is outside the timing
+		std::vector<Message*> batch(n);
+		runBench("queue_message", n, n, [&] {
+			for (std::size_t i = 0; i < n; ++i)
+				e.queueMessage(e.createMessage<Message>(i % TYPES, 0.0));
+		}, [&] { e.tick(); });
+
+		runBench("queue_messages_block", n, n, [&] {
+			for (std::size_t i = 0; i < n; ++i)
+				batch[i] = e.createMessage<Message>(i % TYPES, 0.0);
+			e.queueMessages(&batch[0], n);
+		}, [&] { e.tick(); });
+
+		// Queue then one tick, the tick's dispatch is the bulk of the cost
+		runBench("queue_and_dispatch", n, n, [&] {
+			for (std::size_t i = 0; i < n; ++i)
+				e.queueMessage(e.createMessage<Message>(i % TYPES, 0.0));
+			e.tick();
+		});
+	}
+	Engine::instance().clean();
+}
+
+
+// Position updates for 64 entities, latest value wins against a plain queue
+struct BenchPosition {
+	enum { MESSAGE_TYPE = 20 };
+	unsigned int entity;
+	float x, y;
+	BenchPosition(unsigned int e, float px, float py) : entity(e), x(px), y(py) {}
+};
+
+void benchCoalesce() {
+	const std::size_t N = quick_run ? 10000 : 100000;
+	const bool modes[] = { false, true };
+
+	for (auto coalesced : modes) {
+		Engine& e = resetEngine();
+		unsigned long delivered = 0;
+		e.subscribe<BenchPosition>([&delivered](const BenchPosition&) { ++delivered; return true; });
+		if (coalesced)
+			e.coalesceLatest<BenchPosition>([](const BenchPosition& p) { return (unsigned long long)p.entity; });
+
+		runBench(coalesced ? "queue_and_dispatch_coalesced" : "queue_and_dispatch_uncoalesced", 64, N, [&] {
+			for (std::size_t i = 0; i < N; ++i)
+				e.queue<BenchPosition>((unsigned int)(i % 64), (float)i, 0.0f);
+			e.tick();
+		});
+	}
+	Engine::instance().clean();
+}
+
+
+// Delayed messages spread over the next ten seconds, scheduled and then
+// ticked through at 60Hz until every one has been delivered
+void benchScheduled() {
+	const std::size_t counts[] = { 1000, 100000 };
+	const double deltaT = 1.0 / 60.0;
+
+	for (auto n : counts) {
+		Engine& e = resetEngine();
+		e.addListener(std::make_shared<BenchListener>(), 1);
+
+		runBench("queue_message_after", n, n, [&] {
+			for (std::size_t i = 0; i < n; ++i)
+				e.queueMessageAfter(e.createMessage<Message>(1, e.getTimeStamp()), (double)((i * 7919) % 10000) * 0.001);
+		}, [&] {
+			while (e.getScheduledMessageCount())
+				e.tick(deltaT);
+		});
+
+		runBench("scheduled_messages_ticked", n, n, [&] {
+			while (e.getScheduledMessageCount())
+				e.tick(deltaT);
+		}, [&] {
+			for (std::size_t i = 0; i < n; ++i)
+				e.queueMessageAfter(e.createMessage<Message>(1, e.getTimeStamp()), (double)((i * 7919) % 10000) * 0.001);
+		});
+	}
+	Engine::instance().clean();
+}
+
+
+void benchTrigger() {
+	const std::size_t listenerCounts[] = { 1, 4, 16, 64 };
+	const std::size_t wildcardCounts[] = { 0, 4 };
+	const std::size_t N = quick_run ? 20000 : 200000;
+
+	for (auto w : wildcardCounts) {
+		for (auto l : listenerCounts) {
+			Engine& e = resetEngine();
+			for (std::size_t i = 0; i < l; ++i)
+				e.addListener(std::make_shared<BenchListener>(), 1);
+			for (std::size_t i = 0; i < w; ++i)
+				e.addWildCardListener(std::make_shared<BenchListener>());
+
+			Message msg(1, 0.0);
+			runBench(w ? "trigger_message_wildcards4" : "trigger_message", l, N, [&] {
+				for (std::size_t i = 0; i < N; ++i)
+					e.triggerMessage(msg);
+			});
+		}
+	}
+
+	// Nobody listening on the type, the wildcards still see it
+	Engine& e = resetEngine();
+	for (std::size_t i = 0; i < 4; ++i)
+		e.addWildCardListener(std::make_shared<BenchListener>());
+	Message msg(7, 0.0);
+	runBench("trigger_message_wildcard_only", 4, N, [&] {
+		for (std::size_t i = 0; i < N; ++i)
+			e.triggerMessage(msg);
+	});
+
+	// Wildcards whose filters reject the type, no listener is called
+	Engine& f = resetEngine();
+	f.addListener(std::make_shared<BenchListener>(), 1);
+	for (std::size_t i = 0; i < 16; ++i)
+		f.addWildCardListener(std::make_shared<BenchListener>(), WildCardFilter::range(100, 199));
+	Message filtered(1, 0.0);
+	runBench("trigger_message_wildcards_filtered", 16, N, [&] {
+		for (std::size_t i = 0; i < N; ++i)
+			f.triggerMessage(filtered);
+	});
+	Engine::instance().clean();
+}
+
+
+void benchListenerChurn() {
+	const std::size_t counts[] = { 16, 256, 4096 };
+
+	for (auto n : counts) {
+		Engine& e = resetEngine();
+		std::vector<MsgListenerPtr> listeners;
+		for (std::size_t i = 0; i < n; ++i)
+			listeners.push_back(std::make_shared<BenchListener>());
+
+		// n listeners onto one type then off again, in reverse and in order
+		runBench("listener_churn_one_type", n, 2 * n, [&] {
+			for (std::size_t i = 0; i < n; ++i)
+				e.addListener(listeners[i], 1);
+			for (std::size_t i = n; i-- > 0;)
+				e.deleteListener(listeners[i], 1);
+			for (std::size_t i = 0; i < n; ++i)
+				e.addListener(listeners[i], 1);
+			for (std::size_t i = 0; i < n; ++i)
+				e.deleteListener(listeners[i], 1);
+		});
+
+		// One listener each over n types, past the dense table once n is large
+		runBench("listener_churn_many_types", n, n, [&] {
+			for (std::size_t i = 0; i < n; ++i)
+				e.addListener(listeners[i], (MessageType)i);
+			for (std::size_t i = 0; i < n; ++i)
+				e.deleteListener(listeners[i], (MessageType)i);
+		});
+	}
+	Engine::instance().clean();
+}
+
+
+// Building and tearing down a world's registrations, 64 types of n / 64 listeners
+void benchListenerSetup() {
+	const std::size_t counts[] = { 4096, 65536, 262144 };
+	const std::size_t TYPES = 64;
+
+	for (auto n : counts) {
+		std::vector<MsgListenerPtr> listeners;
+		for (std::size_t i = 0; i < n; ++i)
+			listeners.push_back(std::make_shared<BenchListener>());
+		const std::size_t perType = n / TYPES;
+		Engine e;
+
+		runBench("listener_register_one_by_one", n, n, [&] {
+			for (std::size_t t = 0; t < TYPES; ++t)
+				for (std::size_t i = 0; i < perType; ++i)
+					e.addListener(listeners[t * perType + i], (MessageType)t);
+		}, [&] { e.clean(); });
+
+		runBench("listener_register_bulk", n, n, [&] {
+			for (std::size_t t = 0; t < TYPES; ++t)
+				e.addListeners(&listeners[t * perType], perType, (MessageType)t);
+		}, [&] { e.clean(); });
+
+		runBench("listener_teardown", n, n, [&] {
+			e.clean();
+		}, [&] {
+			for (std::size_t t = 0; t < TYPES; ++t)
+				e.addListeners(&listeners[t * perType], perType, (MessageType)t);
+		});
+		e.clean();
+	}
+}
+//-----------------------------------------------------------------------
+
+
+//-----------------------------------------------------------------------
+// States and systems
+void benchStateUpdate() {
+	const std::size_t counts[] = { 8, 64, 1024, 16384 };
+	const double deltaT = 1.0 / 60.0;
+
+	for (auto n : counts) {
+		std::shared_ptr<BenchState> state = std::make_shared<BenchState>(n);
+		std::size_t iterations = std::max<std::size_t>(1, (quick_run ? 20000 : 200000) / n);
+
+		runBench("state_on_update", n, iterations * n, [&] {
+			for (std::size_t i = 0; i < iterations; ++i)
+				state->onUpdate(deltaT);
+		});
+
+		std::shared_ptr<BenchState> arena = std::make_shared<BenchState>(n, true);
+		runBench("state_on_update_arena", n, iterations * n, [&] {
+			for (std::size_t i = 0; i < iterations; ++i)
+				arena->onUpdate(deltaT);
+		});
+	}
+}
+
+
+// Streaming systems in and out, a quarter of the state swapped every update
+class BenchStreamState : public BenchState {
+public:
+	std::vector<EngineSystemPtr> systems_;
+	std::vector<SystemHandle> handles_;
+
+	explicit BenchStreamState(std::size_t count) {
+		for (std::size_t i = 0; i < count; ++i) {
+			systems_.push_back(std::make_shared<BenchSystem>());
+			handles_.push_back(pushBackUpdate(systems_.back(), (int)(i % 8)));
+		}
+	}
+
+	void stream(std::size_t first, std::size_t count) {
+		for (std::size_t i = first; i < first + count; ++i)
+			removeSystem(handles_[i]);
+		for (std::size_t i = first; i < first + count; ++i)
+			handles_[i] = pushBackUpdate(systems_[i], (int)(i % 8));
+	}
+};
+
+
+void benchSystemStreaming() {
+	const std::size_t counts[] = { 64, 1024, 16384 };
+	const double deltaT = 1.0 / 60.0;
+
+	for (auto n : counts) {
+		BenchStreamState state(n);
+		const std::size_t batch = n / 4;
+		std::size_t iterations = std::max<std::size_t>(1, (quick_run ? 20000 : 200000) / n);
+
+		runBench("system_stream_update", n, iterations * batch, [&] {
+			for (std::size_t i = 0; i < iterations; ++i) {
+				state.stream((i % 4) * batch, batch);
+				state.onUpdate(deltaT);
+			}
+		});
+	}
+}
+
+
+// A parallel update whose schedule is rebuilt every tick by a pause
+class BenchScheduleState : public BenchState {
+public:
+	std::vector<EngineSystemPtr> systems_;
+	JobSystem jobs_;
+
+	explicit BenchScheduleState(std::size_t count) {
+		for (std::size_t i = 0; i < count; ++i) {
+			systems_.push_back(std::make_shared<BenchSystem>());
+			pushBackUpdate(systems_.back());
+			declareAccess(systems_.back(), (ResourceID)(i % 32), i % 4 == 0 ? WRITE : READ);
+			declareAccess(systems_.back(), (ResourceID)((i * 7) % 32), READ);
+		}
+		jobs_.start(1);
+		setJobSystem(&jobs_);
+	}
+	~BenchScheduleState() {
+		setJobSystem(0);
+		jobs_.stop();
+	}
+};
+
+
+void benchScheduleRebuild() {
+	const std::size_t counts[] = { 64, 1024, 4096 };
+	const double deltaT = 1.0 / 60.0;
+
+	for (auto n : counts) {
+		BenchScheduleState state(n);
+		std::size_t iterations = std::max<std::size_t>(1, (quick_run ? 2000 : 20000) / n);
+
+		runBench("schedule_rebuild_update", n, iterations, [&] {
+			for (std::size_t i = 0; i < iterations; ++i) {
+				EngineSystemPtr& sys = state.systems_[i % n];
+				if (sys->isPaused())
+					sys->unPause();
+				else
+					sys->pause();
+				state.onUpdate(deltaT);
+			}
+		});
+	}
+}
+
+
+void benchStateTransitions() {
+	const std::size_t N = quick_run ? 10000 : 100000;
+	Engine& e = resetEngine();
+	EngineStatePtr a = std::make_shared<BenchState>();
+	EngineStatePtr b = std::make_shared<BenchState>();
+
+	runBench("push_pop_state", 1, N, [&] {
+		for (std::size_t i = 0; i < N; ++i) {
+			e.pushState((i & 1) ? a : b);
+			e.popState();
+		}
+	});
+
+	// Stack depth grows by N every rep, clean() below unwinds it
+	runBench("queued_state_change_tick", 1, N / 10, [&] {
+		for (std::size_t i = 0; i < N / 10; ++i) {
+			e.queueStateChange((i & 1) ? a : b);
+			e.tick();
+		}
+	});
+	Engine::instance().clean();
+}
+
+
+// Spins for a fixed time in both halves of the frame, like a CPU bound scene
+class BenchSpinSystem : public EngineSystem {
+public:
+	long long spin_ns_;
+	explicit BenchSpinSystem(long long spinNs) : spin_ns_(spinNs) {}
+	static void spin(long long ns) {
+		long long end = C_Timer::now() + ns;
+		while (C_Timer::now() < end)
+			;
+	}
+	void onRender(const double&) { spin(spin_ns_); }
+	void onUpdate(const double&) { spin(spin_ns_); }
+};
+
+class BenchSpinState : public EngineState {
+public:
+	explicit BenchSpinState(long long spinNs) {
+		emplaceSystem<BenchSpinSystem>(BOTHLISTS, 0, spinNs);
+	}
+	void enter() {}
+	void exit() {}
+};
+
+
+void benchPipelinedRender() {
+	const long long spins[] = { 20000, 200000 };
+	const double deltaT = 1.0 / 60.0;
+
+	for (auto spin : spins) {
+		const std::size_t TICKS = quick_run ? 20 : 200;
+		const std::size_t ticks = spin > 100000 ? TICKS / 10 : TICKS;
+		Engine e;
+		e.start();
+		e.pushState(std::make_shared<BenchSpinState>(spin));
+
+		runBench("tick_serial_render", spin / 1000, ticks, [&] {
+			for (std::size_t i = 0; i < ticks; ++i)
+				e.tick(deltaT);
+		});
+
+		e.setPipelinedRender(true);
+		runBench("tick_pipelined_render", spin / 1000, ticks, [&] {
+			for (std::size_t i = 0; i < ticks; ++i)
+				e.tick(deltaT);
+			e.waitForRender();
+		});
+		e.clean();
+	}
+}
+
+
+// A recorded session played back, 64 queued messages a tick
+void benchReplay() {
+	const std::size_t TICKS = quick_run ? 200 : 2000;
+	const std::size_t PERTICK = 64;
+	const char* path = "engine_bench_replay.log";
+
+	Engine& e = resetEngine();
+	for (MessageType t = 0; t < 8; ++t)
+		e.addListener(std::make_shared<BenchListener>(), t);
+
+	MessageRecorder recorder;
+	if (!recorder.open(path, e.getTimeStamp()))
+		return;
+	e.setRecorder(&recorder);
+	for (std::size_t t = 0; t < TICKS; ++t) {
+		for (std::size_t i = 0; i < PERTICK; ++i)
+			e.queueMessage(e.createMessage<Message>(i % 8, e.getTimeStamp()));
+		e.tick(1.0 / 60.0);
+	}
+	e.setRecorder(0);
+	recorder.close();
+
+	MessageReplay replay;
+	if (replay.load(path)) {
+		runBench("replay_session", TICKS, TICKS * PERTICK, [&] {
+			replay.rewind();
+			replay.run(e);
+		});
+	}
+	std::remove(path);
+	Engine::instance().clean();
+}
+//-----------------------------------------------------------------------
+
+
+//-----------------------------------------------------------------------
+// Timing
+void benchTimer() {
+	const std::size_t N = quick_run ? 100000 : 1000000;
+	long long total = 0;
+
+	runBench("timer_now", 1, N, [&] {
+		for (std::size_t i = 0; i < N; ++i)
+			total += C_Timer::now();
+	});
+
+	C_Timer timer;
+	timer.start();
+	runBench("timer_tick", 1, N, [&] {
+		for (std::size_t i = 0; i < N; ++i) {
+			timer.tick();
+			total += timer.getDeltaTicks();
+		}
+	});
+
+	// Keeps the loops from being optimised away
+	if (total == 42)
+		std::printf("\n");
+}
+//-----------------------------------------------------------------------
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "--quick") == 0)
+			quick_run = true;
+		else
+			name_filter = argv[i];
+	}
+
+	benchQueueDispatch();
+	benchCoalesce();
+	benchScheduled();
+	benchTrigger();
+	benchListenerChurn();
+	benchListenerSetup();
+	benchStateUpdate();
+	benchSystemStreaming();
+	benchScheduleRebuild();
+	benchStateTransitions();
+	benchPipelinedRender();
+	benchReplay();
+	benchTimer();
+	return 0;
+}
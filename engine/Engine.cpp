@@ -4,7 +4,10 @@
 /==========================================================================*/
 
 #include <algorithm>
+#include <atomic>
+#include <cmath>
 #include "Engine.h"
+#include "MessageRecorder.h"
 #ifdef CONSOL
 #include "Console.h"
 #endif
@@ -23,38 +26,45 @@ namespace engine {
 //
 // Arguments:	MsgListenerPtr - A pointer to a message listener
 //				MessageType - the message type to pair the listener to.
-// Returns:		true if successful, false otherwise
+// Returns:		a handle for removeListener, invalid if the listener was
+//				already paired to the type
 //-----------------------------------------------------------------------
-bool Engine::addListener(MsgListenerPtr l, const MessageType& type) {
-	// Check to see if one exists first
-	MessageListenerMap::iterator listenerMapItr = listener_map_.find(type);
-	if(listenerMapItr == listener_map_.end()) {
-		MessageListenerMapIResult insertResult = listener_map_.insert(
-			MessageListenerMapPair(type, ListenerList()));
-
-		// Pair insertion failed!!
-		if(!insertResult.second)
-			return false;
+ListenerHandle Engine::addListener(MsgListenerPtr l, const MessageType& type) {
+	// Creates the set for the type if one does not exist yet, duplicates are rejected
+	unsigned int id = nextListenerID();
+	unsigned int slot = listener_table_.get(type).add(l, id);
+	if(slot == ListenerSet::NOSLOT)
+		return ListenerHandle();
+	return ListenerHandle(type, slot, id, false);
+}
 
-		// Somehow created an empty table?
-		if(insertResult.first == listener_map_.end())
-			return false;
-		
-		// replace the listenerList iterator so it can be updated
-		listenerMapItr = insertResult.first;
-	}
 
+//-----------------------------------------------------------------------
+// addListeners - Public Engine
+// Description 
+//		Pairs a block of listeners to a message type, reserving the room
+//		for all of them first.
+//
+// Arguments:	listeners, count - the listeners to pair
+//				MessageType - the message type to pair them to.
+//				handles - count handles to fill in, or NULL
+// Returns:		the number added, duplicates are skipped
+//-----------------------------------------------------------------------
+std::size_t Engine::addListeners(const MsgListenerPtr* listeners, std::size_t count, const MessageType& type,
+	ListenerHandle* handles) {
+	ListenerSet& set = listener_table_.get(type);
+	set.reserve(set.size() + count);
 
-	// Loop through the list to make sure no duplicates exist
-	ListenerList & lList = (*listenerMapItr).second;
-	for(ListenerList::iterator it = lList.begin(), itEnd = lList.end(); it != itEnd; ++it) {
-		if(*it == l) 
-			return false;
+	std::size_t added = 0;
+	for(std::size_t i = 0; i < count; ++i) {
+		unsigned int id = nextListenerID();
+		unsigned int slot = set.add(listeners[i], id);
+		if(slot != ListenerSet::NOSLOT)
+			++added;
+		if(handles)
+			handles[i] = slot == ListenerSet::NOSLOT ? ListenerHandle() : ListenerHandle(type, slot, id, false);
 	}
-
-	// Everything checks out, add the listener
-	lList.push_back(l);
-	return true;
+	return added;
 }
 
 
@@ -62,54 +72,183 @@ bool Engine::addListener(MsgListenerPtr l, const MessageType& type) {
 // addWildCardListener - Public Engine
 // Description 
 //		Adds a listener as a wild card.
-//      These listeners receive every message every tick
+//      These listeners receive every message every tick that passes
+//		their filter.
 //
 // Arguments:	MsgListenerPtr - A pointer to a message listener
-// Returns:		true if successful, false otherwise
+//				WildCardFilter - the message types to send it
+// Returns:		a handle for removeListener, invalid if the listener was
+//				already a wild card
 //-----------------------------------------------------------------------
-bool Engine::addWildCardListener(MsgListenerPtr l) {
-	// First check to make sure this doesnt already exist
-	ListenerList::iterator i = std::find(wildcard_listener_list_.begin(), wildcard_listener_list_.end(), l);
+ListenerHandle Engine::addWildCardListener(MsgListenerPtr l, const WildCardFilter& filter) {
+	unsigned int id = nextListenerID();
+	unsigned int slot = wildcard_listeners_.add(l, id, filter);
+	if(slot == ListenerSet::NOSLOT)
+		return ListenerHandle();
+	return ListenerHandle(0, slot, id, true);
+}
 
-	// This listener is already in the list
-	if (i != wildcard_listener_list_.end())
+
+//-----------------------------------------------------------------------
+// removeListener - Public Engine
+// Description 
+//		Unpairs the listener a handle was returned for.  Safe to call from
+//		inside onMessage, the listener is not called again once removed.
+//
+// Arguments:	ListenerHandle - from addListener or addWildCardListener
+// Returns:		true if removed, false if the handle was stale or invalid
+//-----------------------------------------------------------------------
+bool Engine::removeListener(const ListenerHandle& handle) {
+	if(!handle)
 		return false;
 
-	// Add it to the list.
-	wildcard_listener_list_.push_back(l);
-	
-	return true;
+	ListenerSet* listeners = handle.wildcard ? &wildcard_listeners_ : listener_table_.find(handle.type);
+	return listeners && listeners->remove(handle.slot, handle.id);
+}
+
+
+unsigned int Engine::nextListenerID() {
+	if(++next_listener_id_ == 0)
+		++next_listener_id_;
+	return next_listener_id_;
 }
 
 
 
 //-----------------------------------------------------------------------
-// triggerMessage - Public Engine
+// sendMessage - Private Engine
 // Description 
-//		Processes the message now.
+//		Processes the message now, the body of triggerMessage.
 //
-// Arguments:	MessagePtr - a pointer to the message to send now.
+// Arguments:	Message - the message to send now, it does not need to be pooled.
+//				batchConsumed - NULL unless the batch listeners already had
+//					the message, then their consumed flag for it
 // Returns:		an enum value:	NOTCONSUMED - the msg was not consumed
 //								CONSUMED - msg was consumed,
 //								NOLISTENER - no listener for msg
 //-----------------------------------------------------------------------
-Engine::MsgStatus Engine::triggerMessage(MessagePtr msg) {
+Engine::MsgStatus Engine::sendMessage(const Message& msg, const unsigned char* batchConsumed) {
+	if(!message_stats_enabled_)
+		return deliverMessage(msg, 0, batchConsumed);
+
+	// Messages the listeners trigger are timed on their own types, their
+	// time comes back in nested_handler_time_ and is taken off this one
+	const long long outer = nested_handler_time_;
+	nested_handler_time_ = 0;
+	const long long start = C_Timer::now();
+	std::size_t deliveries = 0;
+	Engine::MsgStatus status = deliverMessage(msg, &deliveries, batchConsumed);
+	const long long elapsed = C_Timer::now() - start;
+
+	MessageStats& stats = message_stats_.get(msg.getType());
+	++stats.triggered;
+	stats.deliveries += deliveries;
+	stats.handler_time += elapsed - nested_handler_time_;
+	nested_handler_time_ = outer + elapsed;
+	if(status == CONSUMED)
+		++stats.consumed;
+	else if(status == NOLISTENER)
+		++stats.no_listener;
+	return status;
+}
+
+
+//-----------------------------------------------------------------------
+// recordTrigger - Private Engine
+// Description 
+//		triggerMessage while a recorder is set.  Logs the message if it is
+//		an input, what its listeners send in turn is left out.
+//
+// Arguments:	msg - the message to send now
+// Returns:		the same values as triggerMessage
+//-----------------------------------------------------------------------
+Engine::MsgStatus Engine::recordTrigger(const Message& msg) {
+	if(isRecording())
+		recorder_->recordTrigger(msg);
+
+	++record_depth_;
+	MsgStatus status = sendMessage(msg, 0);
+	--record_depth_;
+	return status;
+}
+
+
+bool Engine::isRecording() const {
+	return record_depth_ == 0 || recorder_->getScope() == MessageRecorder::ALL;
+}
+
+
+//-----------------------------------------------------------------------
+// deliverMessage - Private Engine
+// Description 
+//		Hands the message to its batch listeners, typed handlers,
+//		listeners and the wildcard listeners.
+//
+// Arguments:	Message - the message to send
+//				deliveries - if not NULL, set to the number of handlers called
+//				batchConsumed - as for sendMessage
+// Returns:		the same values as triggerMessage
+//-----------------------------------------------------------------------
+Engine::MsgStatus Engine::deliverMessage(const Message& msg, std::size_t* deliveries, const unsigned char* batchConsumed) {
 	Engine::MsgStatus status = NOTCONSUMED;
 
-	MessageListenerMap::iterator mapItr = listener_map_.find(msg->getType());
-	if(mapItr == listener_map_.end()) 
+	// Index loops, a listener may register more listeners while it runs
+	ListenerSet* listeners = listener_table_.find(msg.getType());
+	if(!listeners) 
 		status = NOLISTENER;
 	else {
-        for(auto &itr : mapItr->second)
-			if(itr->onMessage(msg))
+		if(batchConsumed) {
+			if(*batchConsumed)
+				status = CONSUMED;
+		}
+		else if(listeners->batchSize()) {
+			// Not part of a dispatch, the batch listeners get a batch of one
+			const Message* single = &msg;
+			unsigned char consumed = 0;
+			MessageBatch batch(&single, &consumed, 1);
+			runBatchListeners(*listeners, batch);
+			if(consumed)
+				status = CONSUMED;
+		}
+
+		// Typed handlers first, one call into the list then direct calls per handler
+		TypedHandlerListBase* typed = listeners->getTyped();
+		if(typed && typed->dispatch(msg))
+			status = CONSUMED;
+
+		// Removed listeners are NULL until the set compacts after the loop
+		std::size_t calls = 0;
+		listeners->beginDispatch();
+        for(std::size_t i = 0; i < listeners->size(); ++i) {
+			MessageListener* l = (*listeners)[i];
+			if(!l)
+				continue;
+			++calls;
+			if(l->onMessage(msg))
 				status = CONSUMED;
+		}
+		listeners->endDispatch();
+
+		if(deliveries)
+			*deliveries += calls + listeners->batchSize() + (typed ? typed->size() : 0);
 	}
 
-	// Send the message to the wildcard listeners
-	for (auto &itr : wildcard_listener_list_)
-        if(itr->onMessage(msg))
+	// Send the message to the wildcard listeners, the filters are checked before any call
+	std::size_t calls = 0;
+	const MessageType type = msg.getType();
+	wildcard_listeners_.beginDispatch();
+	for (std::size_t i = 0; i < wildcard_listeners_.size(); ++i) {
+		MessageListener* l = wildcard_listeners_.get(i, type);
+		if(!l)
+			continue;
+		++calls;
+        if(l->onMessage(msg))
             status = CONSUMED;
+	}
+	wildcard_listeners_.endDispatch();
 
+	if(deliveries)
+		*deliveries += calls;
 	return status;
 }
 
@@ -119,51 +258,994 @@ Engine::MsgStatus Engine::triggerMessage(MessagePtr msg) {
 // Description 
 //		Queue the message to be processed on the next iteration.
 //
-// Arguments:	MessagePtr - a pointer to the message to queue.
+// Arguments:	Message - a pooled message from createMessage(),
+//					the engine takes over the caller's reference.
+//				MsgPriority - the lane to queue the message in
 // Returns:		an enum value:	NOTCONSUMED - the msg was not consumed
 //								NOLISTENER - no listener for msg
 //								SUCCESS - success
 //-----------------------------------------------------------------------
-Engine::MsgStatus Engine::queueMessage(MessagePtr msg) {
-	// Check for a listener, if no listeners then skip the msg.
-	MessageListenerMap::iterator mapItr = listener_map_.find(msg->getType());
-	if(mapItr == listener_map_.end())
-		return NOLISTENER;
+Engine::MsgStatus Engine::queueMessage(Message* msg, MsgPriority priority) {
+	// From a worker, merged in by the tick() thread once the update is done
+	if(!message_pool_.isOwnerThread()) {
+		worker_queue_[priority].post(msg);
+		return SUCCESS;
+	}
+	if(recorder_ && isRecording())
+		recorder_->recordQueue(*msg, (unsigned char)priority);
+	return enqueue(msg, priority);
+}
+
 
-	if(mapItr->second.empty())
+//-----------------------------------------------------------------------
+// enqueue - Private Engine
+// Description 
+//		The body of queueMessage, without the recording.
+//
+// Arguments:	Message - a pooled message, the engine takes over the
+//					caller's reference.
+//				MsgPriority - the lane to queue the message in
+// Returns:		the same values as queueMessage
+//-----------------------------------------------------------------------
+Engine::MsgStatus Engine::enqueue(Message* msg, MsgPriority priority) {
+	// Check for a listener, if no listeners then skip the msg.
+	ListenerSet* listeners = listener_table_.find(msg->getType());
+	if(!listeners || listeners->empty()) {
+		if(message_stats_enabled_)
+			++message_stats_.get(msg->getType()).no_listener;
+		MessagePool::release(msg);
 		return NOLISTENER;
+	}
 
-	message_queue_[current_msg_queue_].push_back(msg);
+	if(message_stats_enabled_)
+		++message_stats_.get(msg->getType()).queued;
+	if(!coalescers_.empty() && priority != IMMEDIATE)
+		coalesce(msg, priority);
+	message_queue_[current_msg_queue_][priority].push_back(msg);
 	return SUCCESS;
 }
 
 
+//-----------------------------------------------------------------------
+// queueMessageAt - Public Engine
+// Description 
+//		Puts the message on the timer wheel until the engine's clock
+//		reaches time.
+//
+// Arguments:	msg - a pooled message, the engine takes over the
+//					caller's reference.
+//				time - the engine time stamp to queue it at
+//				priority - the lane it is queued in when it comes due
+// Returns:		the id to cancel it with, 0 if it was queued at once
+//				or dropped for a NaN time
+//-----------------------------------------------------------------------
+TimerID Engine::queueMessageAt(Message* msg, const double& time, MsgPriority priority) {
+	if(std::isnan(time)) {
+		MessagePool::release(msg);
+		return 0;
+	}
+	if(recorder_ && isRecording())
+		recorder_->recordQueueAt(*msg, (unsigned char)priority, time);
+
+	if(time <= current_timestamp_) {
+		enqueue(msg, priority);
+		return 0;
+	}
+
+	// Rounded up so a message never comes due early.  Times too far out
+	// for a tick count, infinity too, wait in the overflow for good.
+	double ticks = std::ceil(time / schedule_resolution_);
+	unsigned long long due = MAXSCHEDULETICK;
+	if(ticks < (double)MAXSCHEDULETICK)
+		due = (unsigned long long)ticks;
+	return scheduled_.add(ScheduledMessage(msg, priority), due);
+}
+
+
+bool Engine::cancelScheduledMessage(TimerID id) {
+	ScheduledMessage scheduled;
+	if(!scheduled_.cancel(id, scheduled))
+		return false;
+	MessagePool::release(scheduled.msg);
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+// queueDueMessages - Private Engine
+// Description 
+//		Queues every scheduled message the clock has reached, earliest
+//		first, ahead of this tick's dispatch.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::queueDueMessages() {
+	unsigned long long now = (unsigned long long)std::floor(current_timestamp_ / schedule_resolution_);
+	scheduled_.advance(now, [this](const ScheduledMessage& scheduled) {
+		enqueue(scheduled.msg, scheduled.priority);
+	});
+}
+
+
+//-----------------------------------------------------------------------
+// coalesce - Private Engine
+// Description 
+//		Makes msg the latest of its key if its type has a CoalescePolicy.
+//		The message it replaces stays in its lane, marked, until the flip
+//		drops it.
+//
+// Arguments:	msg - the message being queued
+//				priority - the lane it is going into
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::coalesce(Message* msg, MsgPriority priority) {
+	std::unordered_map<MessageType, Coalescer>::iterator itr = coalescers_.find(msg->getType());
+	if(itr == coalescers_.end())
+		return;
+
+	Coalescer& coalescer = itr->second;
+	unsigned long long key = coalescer.policy.key ? coalescer.policy.key(*msg) : 0;
+	std::pair<std::unordered_map<unsigned long long, Message*>::iterator, bool> slot = coalescer.latest[priority].insert(std::make_pair(key, msg));
+	if(slot.second)
+		return;
+
+	Message* older = slot.first->second;
+	if(coalescer.policy.merge)
+		coalescer.policy.merge(*older, *msg);
+	older->superseded_ = 1;
+	++superseded_count_[priority];
+	slot.first->second = msg;
+
+	++coalesced_message_count_;
+	if(message_stats_enabled_)
+		++message_stats_.get(msg->getType()).coalesced;
+}
+
+
+//-----------------------------------------------------------------------
+// coalesceOlder - Private Engine
+// Description 
+//		Indexes a message going back into the active side, carried over
+//		or requeued, behind which newer ones may already be queued.  If
+//		one has its key, msg is merged into it and marked.
+//
+// Arguments:	msg - the message going back into the queue
+//				priority - its lane
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::coalesceOlder(Message* msg, MsgPriority priority) {
+	std::unordered_map<MessageType, Coalescer>::iterator itr = coalescers_.find(msg->getType());
+	if(itr == coalescers_.end())
+		return;
+
+	Coalescer& coalescer = itr->second;
+	unsigned long long key = coalescer.policy.key ? coalescer.policy.key(*msg) : 0;
+	std::pair<std::unordered_map<unsigned long long, Message*>::iterator, bool> slot = coalescer.latest[priority].insert(std::make_pair(key, msg));
+	if(slot.second)
+		return;
+
+	if(coalescer.policy.merge)
+		coalescer.policy.merge(*msg, *slot.first->second);
+	msg->superseded_ = 1;
+	++superseded_count_[priority];
+
+	++coalesced_message_count_;
+	if(message_stats_enabled_)
+		++message_stats_.get(msg->getType()).coalesced;
+}
+
+
+//-----------------------------------------------------------------------
+// dropSuperseded - Private Engine
+// Description 
+//		Takes the coalesced messages out of the lanes that are about to
+//		be dispatched, keeping the order of the rest.
+//
+// Arguments:	lanes - the side of the queue just flipped to processing
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::dropSuperseded(MessageQueue* lanes) {
+	for (auto& entry : coalescers_)
+		for (auto& lane : entry.second.latest)
+			lane.clear();
+
+	for (int lane = HIGH; lane < PRIORITYCOUNT; ++lane) {
+		if(!superseded_count_[lane])
+			continue;
+		superseded_count_[lane] = 0;
+
+		// Rotate the lane through itself, the capacity is already there
+		MessageQueue& queue = lanes[lane];
+		for (std::size_t i = 0, count = queue.size(); i < count; ++i) {
+			Message* msg = queue.front();
+			queue.pop_front();
+			if(msg->superseded_)
+				MessagePool::release(msg);
+			else
+				queue.push_back(msg);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// queueMessages - Public Engine
+// Description 
+//		Queue a block of messages to be processed on the next iteration.
+//
+// Arguments:	msgs - an array of pooled messages, the engine takes over
+//					the caller's reference on every one of them.
+//				count - the number of messages in msgs
+//				MsgPriority - the lane to queue the messages in
+// Returns:		the number of messages that found a listener and were queued
+//-----------------------------------------------------------------------
+std::size_t Engine::queueMessages(Message* const* msgs, std::size_t count, MsgPriority priority) {
+	if(!message_pool_.isOwnerThread()) {
+		worker_queue_[priority].post(msgs, count);
+		return count;
+	}
+	MessageQueue& queue = message_queue_[current_msg_queue_][priority];
+	queue.reserve(queue.size() + count);
+
+	std::size_t queued = 0;
+	for (std::size_t i = 0; i < count; ++i) {
+		if(queueMessage(msgs[i], priority) == SUCCESS)
+			++queued;
+	}
+	return queued;
+}
+
+
 
 //-----------------------------------------------------------------------
 // dispatchMessages - Private Engine
 // Description 
-//		Send all of the queued messages.
+//		Send the queued messages, lane by lane.  The NORMAL and DEFERRABLE
+//		lanes stop once the dispatch budget is spent and keep the rest,
+//		in order, for the next tick.
 //
 // Arguments:	None.
 // Returns:		None.
 //-----------------------------------------------------------------------
 void Engine::dispatchMessages() {
+	// Messages posted from other threads join the active queue before it is flipped
+	drainInbox();
+
 	// flip the current queue so that during message processing more msgs can be sent.
-    static bool queue_to_process;
-    queue_to_process = current_msg_queue_;
+	const bool queueToProcess = current_msg_queue_;
 	current_msg_queue_ = !current_msg_queue_;
-	message_queue_[current_msg_queue_].clear();
+	for (auto& lane : message_queue_[current_msg_queue_])
+		lane.clear();
+
+	MessageQueue* processing = message_queue_[queueToProcess];
+	MessageQueue* pending = message_queue_[current_msg_queue_];
+	if(!coalescers_.empty())
+		dropSuperseded(processing);
+
+	const bool timed = dispatch_budget_time_ > 0.0;
+	const long long start = timed ? C_Timer::now() : 0;
+	const long long timeBudget = (long long)(dispatch_budget_time_ * 1e9);
+	std::size_t delivered = 0;
+
+	// IMMEDIATE runs until the listeners stop queueing more of it
+	MessageQueue& immediate = processing[IMMEDIATE];
+	do {
+		delivered += immediate.size();
+		dispatchRange(immediate, 0, immediate.size(), immediate_requeue_, IMMEDIATE);
+		immediate.clear();
+		immediate.swap(pending[IMMEDIATE]);
+	} while(!immediate.empty());
+	pending[IMMEDIATE].swap(immediate_requeue_);
+
+	delivered += processing[HIGH].size();
+	dispatchRange(processing[HIGH], 0, processing[HIGH].size(), pending[HIGH], HIGH);
+	processing[HIGH].clear();
+
+	// The budgeted lanes go in chunks so the clock is only read now and then.
+	// The clock is first read after a chunk, so a time budget always moves
+	// the NORMAL lane along by at least one chunk.
+	deferred_message_count_ = 0;
+	bool spent = dispatch_budget_count_ && delivered >= dispatch_budget_count_;
+	for (int lane = NORMAL; lane <= DEFERRABLE; ++lane) {
+		MessageQueue& queue = processing[lane];
+		std::size_t done = 0;
+		const std::size_t count = queue.size();
+
+		while(done < count && !spent) {
+			std::size_t end = count;
+			if(dispatch_budget_count_)
+				end = std::min(end, done + (dispatch_budget_count_ - delivered));
+			if(timed)
+				end = std::min(end, done + DISPATCHCHUNK);
+
+			dispatchRange(queue, done, end, pending[lane], (MsgPriority)lane);
+			delivered += end - done;
+			done = end;
+
+			spent = (dispatch_budget_count_ && delivered >= dispatch_budget_count_)
+				|| (timed && C_Timer::now() - start >= timeBudget);
+		}
+
+		if(done < count) {
+			deferred_message_count_ += count - done;
+			carryOver(queue, done, pending[lane], (MsgPriority)lane);
+		}
+		else
+			queue.clear();
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// dispatchRange - Private Engine
+// Description 
+//		Sends processing[begin, end), the queue's reference is dropped once
+//		a message is consumed.  Anything the listeners queue lands in the
+//		other side of the queue, so this is a straight sweep.
+//
+// Arguments:	processing - the lane being dispatched
+//				begin, end - the messages to send
+//				requeue - where unconsumed messages go
+//				lane - the lane's priority
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::dispatchRange(MessageQueue& processing, std::size_t begin, std::size_t end, MessageQueue& requeue, MsgPriority lane) {
+	const bool coalescing = !coalescers_.empty() && lane != IMMEDIATE;
+	// Batch listeners go first, then every message goes round the rest in queue order
+	const bool batched = batch_listener_count_ != 0;
+	if(batched) {
+		gatherBatches(processing, begin, end);
+		deliverBatches();
+	}
+
+	for (std::size_t i = begin; i < end; ++i) {
+		Message* msg = processing[i];
+		if(message_stats_enabled_)
+			recordQueueWait(*msg);
+
+		const unsigned char* batchConsumed = 0;
+		if(batched && batch_slots_[i - begin].first) {
+			const std::pair<unsigned int, unsigned int>& slot = batch_slots_[i - begin];
+			batchConsumed = &batch_groups_[slot.first - 1].consumed[slot.second];
+		}
 
-	// Dispatch messages  
-	while (!message_queue_[queue_to_process].empty()) {
-		MessagePtr msg = message_queue_[queue_to_process].front();
-		message_queue_[queue_to_process].pop_front();
-		if(triggerMessage(msg) == NOTCONSUMED)
-			message_queue_[current_msg_queue_].push_back(msg);
+		if(sendMessage(*msg, batchConsumed) == NOTCONSUMED && shouldRequeue(*msg)) {
+			if(message_stats_enabled_)
+				++message_stats_.get(msg->getType()).requeued;
+			if(coalescing)
+				coalesceOlder(msg, lane);
+			requeue.push_back(msg);
+		}
+		else
+			MessagePool::release(msg);
 	}
 }
 
 
+//-----------------------------------------------------------------------
+// carryOver - Private Engine
+// Description 
+//		Moves the undelivered end of a lane to the front of the lane the
+//		next tick dispatches, ahead of whatever was queued meanwhile.
+//
+// Arguments:	processing - the lane that ran out of budget
+//				done - how many of its messages were sent
+//				pending - the same lane on the active side
+//				lane - the lane's priority
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::carryOver(MessageQueue& processing, std::size_t done, MessageQueue& pending, MsgPriority lane) {
+	processing.pop_front(done);
+	if(!coalescers_.empty()) {
+		for (std::size_t i = 0; i < processing.size(); ++i)
+			coalesceOlder(processing[i], lane);
+	}
+	for (std::size_t i = 0, count = pending.size(); i < count; ++i)
+		processing.push_back(pending[i]);
+	pending.swap(processing);
+	processing.clear();
+}
+
+
+//-----------------------------------------------------------------------
+// gatherBatches - Private Engine
+// Description 
+//		Groups the queue by type for the types with batch listeners and
+//		records where each message landed.
+//
+// Arguments:	processing - the lane about to be dispatched
+//				begin, end - the part of it being sent
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::gatherBatches(const MessageQueue& processing, std::size_t begin, std::size_t end) {
+	for (std::size_t g = 0; g < batch_group_count_; ++g) {
+		batch_groups_[g].messages.clear();
+		batch_groups_[g].consumed.clear();
+	}
+	batch_group_count_ = 0;
+	batch_slots_.resize(end - begin);
+
+	// Messages tend to come in runs of a type, so the last group is tried first
+	std::size_t last = 0;
+	for (std::size_t i = begin; i < end; ++i) {
+		const Message* msg = processing[i];
+		batch_slots_[i - begin].first = 0;
+
+		if(!batch_group_count_ || batch_groups_[last].type != msg->getType()) {
+			ListenerSet* listeners = listener_table_.find(msg->getType());
+			if(!listeners || !listeners->batchSize())
+				continue;
+
+			std::size_t g = 0;
+			while(g < batch_group_count_ && batch_groups_[g].listeners != listeners)
+				++g;
+			if(g == batch_group_count_) {
+				if(g == batch_groups_.size())
+					batch_groups_.push_back(BatchGroup());
+				batch_groups_[g].listeners = listeners;
+				batch_groups_[g].type = msg->getType();
+				++batch_group_count_;
+			}
+			last = g;
+		}
+
+		BatchGroup& group = batch_groups_[last];
+		batch_slots_[i - begin].first = (unsigned int)last + 1;
+		batch_slots_[i - begin].second = (unsigned int)group.messages.size();
+		group.messages.push_back(msg);
+		group.consumed.push_back(0);
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// deliverBatches - Private Engine
+// Description 
+//		Hands each gathered group to its type's batch listeners.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::deliverBatches() {
+	for (std::size_t g = 0; g < batch_group_count_; ++g) {
+		BatchGroup& group = batch_groups_[g];
+		MessageBatch batch(&group.messages[0], &group.consumed[0], group.messages.size());
+
+		if(!message_stats_enabled_) {
+			runBatchListeners(*group.listeners, batch);
+			continue;
+		}
+
+		// Timed like sendMessage(), less what the batch listeners trigger
+		const long long outer = nested_handler_time_;
+		nested_handler_time_ = 0;
+		const long long start = C_Timer::now();
+		runBatchListeners(*group.listeners, batch);
+		const long long elapsed = C_Timer::now() - start;
+		message_stats_.get(group.type).handler_time += elapsed - nested_handler_time_;
+		nested_handler_time_ = outer + elapsed;
+	}
+}
+
+
+// Removed batch listeners are NULL until the set compacts after the loop.
+// Each is held for its call, it may remove itself.
+void Engine::runBatchListeners(ListenerSet& listeners, MessageBatch& batch) {
+	listeners.beginDispatch();
+	for (std::size_t i = 0; i < listeners.batchSize(); ++i) {
+		BatchListenerPtr l = listeners.getBatch(i);
+		if(l)
+			l->onMessages(batch);
+	}
+	listeners.endDispatch();
+}
+
+
+void Engine::recordQueueWait(const Message& msg) {
+	MessageStats& stats = message_stats_.get(msg.getType());
+	double wait = current_timestamp_ - msg.getTimeStamp();
+	++stats.waits;
+	stats.wait_total += wait;
+	if(wait > stats.wait_max)
+		stats.wait_max = wait;
+}
+
+
+//-----------------------------------------------------------------------
+// shouldRequeue - Private Engine
+// Description 
+//		Checks an unconsumed message against its MessagePolicy.  Messages
+//		past their limit are counted and handed to the dead letter handler.
+//
+// Arguments:	Message - the unconsumed message
+// Returns:		true if the message goes back in the queue
+//-----------------------------------------------------------------------
+bool Engine::shouldRequeue(Message& msg) {
+	const MessagePolicy& policy = getMessagePolicy(msg.getType());
+
+	if(policy.time_to_live > 0.0 && current_timestamp_ - msg.getTimeStamp() > policy.time_to_live) {
+		++expired_message_count_;
+		if(dead_letter_handler_)
+			dead_letter_handler_(msg, EXPIRED);
+		return false;
+	}
+
+	if(policy.max_requeues != MessagePolicy::UNLIMITED && msg.requeue_count_ >= policy.max_requeues) {
+		++dropped_message_count_;
+		if(dead_letter_handler_)
+			dead_letter_handler_(msg, REQUEUE_LIMIT);
+		return false;
+	}
+
+	++msg.requeue_count_;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+// drainInbox - Private Engine
+// Description 
+//		Queues what a replay fed in, then the messages posted by other
+//		threads, in posting order, then what the input channels carried,
+//		channel by channel.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::drainInbox() {
+	mergeWorkerQueues();
+	if(replay_inputs_.empty() && inbox_.empty() && input_channels_.empty())
+		return;
+
+	for (auto& input : replay_inputs_)
+		queueInput(input.first, input.second);
+	replay_inputs_.clear();
+	inbox_.drain([this](Message* msg) { queueInput(msg, NORMAL); });
+	for (auto& input : input_channels_) {
+		MsgPriority priority = input.second;
+		input.first->receive([this, priority](Message* msg) { queueInput(msg, priority); });
+	}
+}
+
+
+// Posts from other threads are inputs even though the drain runs inside
+// tick(), they are logged apart so a replay queues them at the same point
+void Engine::queueInput(Message* msg, MsgPriority priority) {
+	if(recorder_)
+		recorder_->recordPost(*msg, (unsigned char)priority);
+	enqueue(msg, priority);
+}
+
+
+//-----------------------------------------------------------------------
+// mergeWorkerQueues - Private Engine
+// Description 
+//		Queues what the systems queued from the workers during a parallel
+//		update, lane by lane.  They were sent from inside the tick so they
+//		are recorded like any other message a system queues.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::mergeWorkerQueues() {
+	for (int lane = 0; lane < PRIORITYCOUNT; ++lane) {
+		if(worker_queue_[lane].empty())
+			continue;
+		MsgPriority priority = (MsgPriority)lane;
+		worker_queue_[lane].drain([this, priority](Message* msg) { queueMessage(msg, priority); });
+	}
+}
+
+
+namespace {
+	// The pool the calling thread last used and the engine it belongs to
+	struct ThreadPoolCache {
+		unsigned long long serial;
+		MessagePool* pool;
+	};
+	thread_local ThreadPoolCache tls_thread_pool = { 0, 0 };
+	std::atomic<unsigned long long> next_engine_serial(1);
+}
+
+
+unsigned long long Engine::nextSerial() {
+	return next_engine_serial.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+// The calling thread's own pool, made on its first message
+MessagePool& Engine::getThreadPool() {
+	if(tls_thread_pool.serial == serial_)
+		return *tls_thread_pool.pool;
+
+	std::lock_guard<std::mutex> lock(thread_pool_mutex_);
+	std::unique_ptr<MessagePool>& pool = thread_pools_[std::this_thread::get_id()];
+	if(!pool)
+		pool.reset(new MessagePool());
+	tls_thread_pool.serial = serial_;
+	tls_thread_pool.pool = pool.get();
+	return *pool;
+}
+
+
+void Engine::removeInputChannel(MessageChannel& channel) {
+	for (std::size_t i = 0; i < input_channels_.size(); ++i) {
+		if(input_channels_[i].first == &channel) {
+			input_channels_.erase(input_channels_.begin() + i);
+			return;
+		}
+	}
+}
+
+
+void Engine::removeOutputChannel(MessageChannel& channel) {
+	output_channels_.erase(std::remove(output_channels_.begin(), output_channels_.end(), &channel),
+		output_channels_.end());
+}
+
+
+//-----------------------------------------------------------------------
+// releaseQueuedMessages - Private Engine
+// Description 
+//		Drops the queue's reference on every pending message.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::releaseQueuedMessages() {
+	for (auto& input : replay_inputs_)
+		MessagePool::release(input.first);
+	replay_inputs_.clear();
+	inbox_.drain([](Message* msg) { MessagePool::release(msg); });
+	for (auto& lane : worker_queue_)
+		lane.drain([](Message* msg) { MessagePool::release(msg); });
+	scheduled_.clear([](const ScheduledMessage& scheduled) { MessagePool::release(scheduled.msg); });
+	for (auto& side : message_queue_) {
+		for (auto& queue : side) {
+			for (std::size_t i = 0, count = queue.size(); i < count; ++i)
+				MessagePool::release(queue[i]);
+			queue.clear();
+		}
+	}
+}
+
+
+void Engine::pushState(EngineStatePtr s) {
+	waitForRender();
+	readyState(s);
+	if(!state_.empty()) {
+		EngineState* covered = state_.front().get();
+		covered->exit();
+		if(covered->getSuspendMode() == EngineState::EVICTED)
+			evictState(covered);
+	}
+	s->enter();
+	state_.push_front(s);
+	restack();
+}
+
+
+void Engine::popState() {
+	if(state_.empty())
+		return;
+
+	waitForRender();
+	state_.front()->exit();
+	state_.pop_front();
+	if(!state_.empty()) {
+		readyState(state_.front());
+		state_.front()->enter();
+	}
+	restack();
+}
+
+
+void Engine::evictSuspendedStates() {
+	waitForRender();
+	std::list<EngineStatePtr>::iterator itr = state_.begin();
+	if(itr == state_.end())
+		return;
+	for(++itr; itr != state_.end(); ++itr)
+		if((*itr)->getSuspendMode() != EngineState::BACKGROUND)
+			evictState(itr->get());
+}
+
+
+void Engine::evictState(EngineState* s) {
+	if(s->getLoadPhase() != EngineState::ACTIVATED)
+		return;
+
+	s->releaseResources();
+	s->load_phase_.store(EngineState::UNLOADED, std::memory_order_release);
+}
+
+
+//-----------------------------------------------------------------------
+// restack - Private Engine
+// Description 
+//		Collects the covered BACKGROUND states for tick() and evicts the
+//		states past the retained limit.  Called whenever the stack changes.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::restack() {
+	waitForRender();
+	background_states_.clear();
+	if(state_.empty())
+		return;
+
+	std::size_t depth = 0;
+	for(std::list<EngineStatePtr>::iterator itr = ++state_.begin(); itr != state_.end(); ++itr) {
+		EngineState* s = itr->get();
+		++depth;
+		if(s->getSuspendMode() == EngineState::BACKGROUND) {
+			s->background_ticks_ = 0;
+			s->background_time_ = 0.0;
+			background_states_.push_back(s);
+		}
+		else if(max_retained_states_ && depth > max_retained_states_)
+			evictState(s);
+	}
+	std::reverse(background_states_.begin(), background_states_.end());
+}
+
+
+void Engine::updateBackground() {
+	for(auto s : background_states_) {
+		s->background_time_ += deltaT_;
+		if(++s->background_ticks_ >= s->getBackgroundInterval()) {
+			s->onUpdate(s->background_time_);
+			s->snapshot_pending_ = true;
+			s->background_ticks_ = 0;
+			s->background_time_ = 0.0;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// render - Private Engine
+// Description 
+//		Swaps the snapshots the update published, then renders the tick
+//		or hands it to the render thread once the last one is done.
+//
+// Arguments:	EngineStatePtr - the current state, held for the render
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::render(const EngineStatePtr& current) {
+	if(!pipelined_render_) {
+		for(auto s : background_states_)
+			s->beginRender(false);
+		if(current)
+			current->beginRender(false);
+		renderFrame(background_states_, current.get(), interpolation_alpha_);
+		return;
+	}
+
+	waitForRender();
+	for(auto s : background_states_)
+		s->beginRender(true);
+	if(current)
+		current->beginRender(true);
+
+	std::lock_guard<std::mutex> lock(render_mutex_);
+	render_state_ = current;
+	render_background_ = background_states_;
+	render_alpha_ = interpolation_alpha_;
+	render_pending_ = true;
+	render_wake_.notify_one();
+}
+
+
+void Engine::renderFrame(const std::vector<EngineState*>& background, EngineState* current, const double& alpha) {
+	for(auto s : background)
+		if(s->rendersWhenCovered())
+			s->onRender(1.0);
+	if(current)
+		current->onRender(alpha);
+}
+
+
+void Engine::renderLoop() {
+#ifdef ENGINE_PROFILE
+	FrameProfiler::setCurrent(render_profiler_.get());
+#endif
+	std::unique_lock<std::mutex> lock(render_mutex_);
+	for(;;) {
+		render_wake_.wait(lock, [this] { return render_pending_ || render_stopping_; });
+		if(!render_pending_)
+			return;
+
+		EngineState* current = render_state_.get();
+		lock.unlock();
+#ifdef ENGINE_PROFILE
+		render_profiler_->beginFrame();
+		renderFrame(render_background_, current, render_alpha_);
+		render_profiler_->endFrame();
+#else
+		renderFrame(render_background_, current, render_alpha_);
+#endif
+		lock.lock();
+		render_pending_ = false;
+		render_done_.notify_all();
+	}
+}
+
+
+void Engine::setPipelinedRender(bool enable) {
+	if(enable == pipelined_render_)
+		return;
+
+	if(enable) {
+#ifdef ENGINE_PROFILE
+		if(!render_profiler_)
+			render_profiler_.reset(new FrameProfiler(1));
+#endif
+		render_stopping_ = false;
+		render_thread_ = std::thread(&Engine::renderLoop, this);
+	}
+	else {
+		waitForRender();
+		{
+			std::lock_guard<std::mutex> lock(render_mutex_);
+			render_stopping_ = true;
+		}
+		render_wake_.notify_one();
+		render_thread_.join();
+	}
+	pipelined_render_ = enable;
+}
+
+
+//-----------------------------------------------------------------------
+// waitForRender - Public Engine
+// Description 
+//		Waits for the render thread to finish the frame it was handed and
+//		gives the rendered states back to the tick() thread.  Returns at
+//		once when nothing is being rendered.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::waitForRender() {
+	if(!pipelined_render_)
+		return;
+
+	std::unique_lock<std::mutex> lock(render_mutex_);
+	render_done_.wait(lock, [this] { return !render_pending_; });
+#ifdef ENGINE_PROFILE
+	// The render thread's samples land in the tick that collects the frame.
+	// Collected between ticks they stay put until the next tick's render
+	// waits, the render thread is idle until then.
+	profiler_.takeSamples(*render_profiler_);
+#endif
+	for(auto s : render_background_)
+		s->endRender();
+	if(render_state_)
+		render_state_->endRender();
+	render_background_.clear();
+	render_state_ = 0;
+}
+
+
+//-----------------------------------------------------------------------
+// loadState - Public Engine
+// Description 
+//		Starts preparing a state on the loader thread and queues the
+//		change to it for once it is ready.  A state that is already
+//		prepared is just queued.
+//
+// Arguments:	EngineStatePtr - the state to load and change to
+// Returns:		false if another load is still running
+//-----------------------------------------------------------------------
+bool Engine::loadState(EngineStatePtr state) {
+	if(loading_state_)
+		return false;
+
+	int phase = EngineState::UNLOADED;
+	if(!state->load_phase_.compare_exchange_strong(phase, EngineState::PREPARING)) {
+		queueStateChange(state);
+		return true;
+	}
+
+	// The engine holds the state until the thread is joined, so the thread only needs the pointer
+	EngineState* s = state.get();
+	s->load_progress_.store(0.0f, std::memory_order_relaxed);
+	s->load_cancelled_.store(false, std::memory_order_relaxed);
+	loading_state_ = state;
+	load_thread_ = std::thread([s] {
+		s->prepare();
+		s->load_progress_.store(1.0f, std::memory_order_relaxed);
+		s->load_phase_.store(EngineState::PREPARED, std::memory_order_release);
+	});
+	return true;
+}
+
+
+void Engine::cancelStateLoad() {
+	if(!loading_state_)
+		return;
+
+	EngineStatePtr state = loading_state_;
+	state->load_cancelled_.store(true, std::memory_order_relaxed);
+	finishLoad();
+
+	// Whatever prepare() got through is not a finished load
+	state->load_phase_.store(EngineState::UNLOADED, std::memory_order_release);
+	state->load_cancelled_.store(false, std::memory_order_relaxed);
+}
+
+
+void Engine::finishLoad() {
+	load_thread_.join();
+	loading_state_ = 0;
+}
+
+
+//-----------------------------------------------------------------------
+// readyState - Private Engine
+// Description 
+//		Brings a state up to ACTIVATED before it is entered, preparing it
+//		here if nothing did yet.
+//
+// Arguments:	EngineStatePtr - the state about to be pushed
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::readyState(const EngineStatePtr& s) {
+	if(s == loading_state_)
+		finishLoad();
+
+	int phase = EngineState::UNLOADED;
+	if(s->load_phase_.compare_exchange_strong(phase, EngineState::PREPARING)) {
+		s->prepare();
+		s->load_progress_.store(1.0f, std::memory_order_relaxed);
+		s->load_phase_.store(EngineState::PREPARED, std::memory_order_release);
+	}
+
+	if(s->getLoadPhase() == EngineState::PREPARED) {
+		s->activate();
+		s->load_phase_.store(EngineState::ACTIVATED, std::memory_order_release);
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// update - Private Engine
+// Description 
+//		Runs the state's update, either once with the frame time or in
+//		fixed steps with the remainder carried over to the next tick.
+//
+// Arguments:	EngineStatePtr - the current state
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::update(const EngineStatePtr& state) {
+	if(fixed_step_ <= 0.0) {
+		state->onUpdate(deltaT_);
+		state->snapshot_pending_ = true;
+		interpolation_alpha_ = 1.0;
+		return;
+	}
+
+	step_accumulator_ += deltaT_;
+	unsigned int steps = 0;
+	while(step_accumulator_ >= fixed_step_ && steps < max_fixed_steps_) {
+		state->onUpdate(fixed_step_);
+		step_accumulator_ -= fixed_step_;
+		++steps;
+	}
+	if(steps)
+		state->snapshot_pending_ = true;
+
+	// Out of steps, drop the whole steps still owed rather than chase them
+	if(step_accumulator_ >= fixed_step_)
+		step_accumulator_ = std::fmod(step_accumulator_, fixed_step_);
+
+	interpolation_alpha_ = step_accumulator_ / fixed_step_;
+}
+
+
 //-----------------------------------------------------------------------
 // tick - Public Engine
 // Description 
@@ -174,13 +1256,48 @@ void Engine::dispatchMessages() {
 // Returns:		None.
 //-----------------------------------------------------------------------
 void Engine::tick() {
-    
-    static EngineStatePtr current_state;
+	// Wait out the frame period before anything is timed
+	pacer_.wait();
+	runTick(0);
+}
+
+
+void Engine::tick(const double& deltaT) {
+	runTick(&deltaT);
+}
+
+
+//-----------------------------------------------------------------------
+// runTick - Private Engine
+// Description 
+//		The body of tick(), one pass through every phase of the frame.
+//
+// Arguments:	deltaT - the length of the tick, 0 to take it from the timer
+// Returns:		None.
+//-----------------------------------------------------------------------
+void Engine::runTick(const double* deltaT) {
+#ifdef ENGINE_PROFILE
+	profiler_.beginFrame();
+	FrameProfiler::setCurrent(&profiler_);
+	// The last render before pipelining was switched off, there is no wait to take it
+	if(render_profiler_ && !pipelined_render_)
+		profiler_.takeSamples(*render_profiler_);
+#endif
+	++record_depth_;
     
 	// First - Update the timer 
-	timer_.tick();
-	current_timestamp_ = timer_.getTime(); 
-	deltaT_ = timer_.getDeltaTime();
+	{
+		ENGINE_PROFILE_PHASE(FrameProfiler::TIMER);
+		if(deltaT) {
+			deltaT_ = *deltaT;
+			current_timestamp_ += deltaT_;
+		}
+		else {
+			timer_.tick();
+			current_timestamp_ = timer_.getTime(); 
+			deltaT_ = timer_.getDeltaTime();
+		}
+	}
 
 #ifdef CONSOLE
 	// Process the Console
@@ -188,29 +1305,68 @@ void Engine::tick() {
 #endif
     
 	// Second - Send out the messages
-	dispatchMessages();
+	{
+		ENGINE_PROFILE_PHASE(FrameProfiler::MESSAGES);
+		if(!scheduled_.empty())
+			queueDueMessages();
+		dispatchMessages();
+	}
 
 	// Third - Check if the engine state needs updated
-	if(queued_state_) {
-		pushState(queued_state_);
-		queued_state_ = 0;
+	{
+		ENGINE_PROFILE_PHASE(FrameProfiler::STATE_CHANGE);
+		if(loading_state_ && loading_state_->getLoadPhase() == EngineState::PREPARED) {
+			EngineStatePtr loaded = loading_state_;
+			finishLoad();
+			pushState(loaded);
+		}
+		if(queued_state_) {
+			pushState(queued_state_);
+			queued_state_ = 0;
+		}
 	}
 
-    current_state = state_.front();
+	// Held for the tick, a system can pop its own state mid update
+	EngineStatePtr current_state = getCurrentState();
 
 	// Fourth - Perform the updates
-    if(current_state)
-		current_state->onUpdate(deltaT_);
+	{
+		ENGINE_PROFILE_PHASE(FrameProfiler::UPDATE);
+		// Covered BACKGROUND states first, bottom of the stack up
+		if(!background_states_.empty())
+			updateBackground();
+		if(current_state)
+			update(current_state);
+
+		// Any frame jobs the systems kicked off have to land before the render
+		job_system_.wait(frame_jobs_);
+		mergeWorkerQueues();
+	}
 
 	// Fifth - Perform the rendering to the screen
-	if (current_state)
-		current_state->onRender(deltaT_);
+	{
+		ENGINE_PROFILE_PHASE(FrameProfiler::RENDER);
+		render(current_state);
+	}
     
 #ifdef CONSOLE
 	if(G_Console->isVisible())
 		G_Console->onRender();
 #endif
 
+	// What this tick sent to other engines goes out as one batch per channel
+	for (auto channel : output_channels_)
+		channel->flush();
+
+	// The tick's inputs were recorded ahead of it, this closes them off
+	--record_depth_;
+	if(recorder_)
+		recorder_->recordTick(deltaT_);
+
+#ifdef ENGINE_PROFILE
+	FrameProfiler::setCurrent(0);
+	profiler_.endFrame();
+#endif
 }
     
 }  // namespace engine
@@ -6,161 +6,253 @@
 #ifndef _ENGINE_
 #define _ENGINE_
 
+#include <condition_variable>
 #include <list>
-#include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
+#include "EngineState.h"
+#include "FramePacer.h"
+#include "ListenerTable.h"
+#include "Message.h"
+#include "MessageChannel.h"
+#include "MessageInbox.h"
+#include "MessagePool.h"
+#include "MessageStats.h"
+#include "Profiler.h"
+#include "RingBuffer.h"
 #include "Timer.h"
+#include "TimerWheel.h"
+#include "TypedMessage.h"
 
 namespace engine {
 
-//-----------------------------------------------------------------------
-// The System interface
-//typedef unsigned long SystemID;	// A globally unique system ID number   TODO - ?needed?
-class EngineSystem {
-protected:
-	bool paused_;
-	bool visible_;
-
-public:
-	EngineSystem() : paused_(false), visible_(true) {}
-	virtual ~EngineSystem() {}
-	virtual void pause() { paused_ = true; }
-	virtual void unPause() { paused_ = false; }
-	virtual bool isVisible() const { return visible_; }
-	virtual bool isPaused() { return paused_; }
-	virtual void setVisibility(bool b) { visible_ = b; }
-
-	virtual void onRender() = 0;
-	virtual void onUpdate(const double& elapsedTime) = 0;
-};
-typedef std::shared_ptr<EngineSystem> EngineSystemPtr;
-//-----------------------------------------------------------------------
-
-
+class MessageRecorder;
 
 //-----------------------------------------------------------------------
-// The EngineState interface
-//typedef unsigned StateID;  // A globally unique state ID number    TODO - ?needed?
-class EngineState {
-private:
-	typedef std::vector<EngineSystemPtr> SystemList;
-	SystemList update_list_;
-	SystemList render_list_;
-
-protected:
-
-	inline virtual void deleteSystem(const EngineSystemPtr& ptr) {
-		if (!render_list_.empty())
-			render_list_.erase(std::remove(render_list_.begin(), render_list_.end(), ptr));
-		if (!update_list_.empty())
-			update_list_.erase(std::remove(render_list_.begin(), render_list_.end(), ptr));
-	}
-
-	inline void pushBackUpdate(const EngineSystemPtr& ptr) {
-		update_list_.push_back(ptr);
-	}
-
-	inline void pushBackRender(const EngineSystemPtr& ptr) {
-		render_list_.push_back(ptr);
-	}
-
+// Engine
+class Engine {
 public:
-	EngineState() {
-#ifndef MAXSYSTEMS
-#define MAXSYSTEMS 5
-#endif
-		update_list_.reserve(MAXSYSTEMS);
-		render_list_.reserve(MAXSYSTEMS);
-	}
-	virtual ~EngineState() {}
-
-	inline virtual void onUpdate(const double& deltaT) {
-		for (auto& sys : update_list_)
-			sys->onUpdate(deltaT);
-	}
-
-	inline virtual void onRender(const double& deltaT) {
-		for (auto& sys : render_list_)
-			sys->onRender();
-	}
-
-	virtual void exit() = 0;
-	virtual void enter() = 0;
-};
-typedef std::shared_ptr<EngineState> EngineStatePtr;
-//-----------------------------------------------------------------------
-
+	// Results of sending a message
+	enum MsgStatus {
+		NOTCONSUMED,
+		CONSUMED,
+		NOLISTENER,
+		SUCCESS
+	};
 
+	// Dispatch order of queued messages.  IMMEDIATE and HIGH are delivered
+	// every tick, NORMAL and DEFERRABLE only as far as the dispatch budget
+	// goes, the rest waits for the next tick.
+	enum MsgPriority {
+		IMMEDIATE,		// also delivers the IMMEDIATE messages queued during the dispatch,
+						// so listeners must not answer every IMMEDIATE with another
+		HIGH,
+		NORMAL,
+		DEFERRABLE,
+		PRIORITYCOUNT
+	};
 
-//-----------------------------------------------------------------------
-// The messaging interface
-typedef unsigned int MessageType;
-class Message {
 private:
-    Message();
-	const double time_stamp_;
-	const MessageType message_type_;
-
-public:
-	Message(const MessageType& type, const double& stamp)
-		: message_type_(type), time_stamp_(stamp) {}
-	virtual ~Message() {}
-
-	virtual const double& getTimeStamp() const { return time_stamp_; }
-	virtual const MessageType& getType() const { return message_type_; }
-};
-typedef std::shared_ptr<Message> MessagePtr;
+	Engine(const Engine&);
+	Engine& operator=(const Engine&);
 
+	engine::C_Timer timer_;
+	FramePacer pacer_;						// off until setTargetTickRate()
 
-class MessageListener {
-public:
-	virtual ~MessageListener() {}
-	virtual bool onMessage(MessagePtr msg) = 0;
-};
-typedef std::shared_ptr<MessageListener> MsgListenerPtr;
-//-----------------------------------------------------------------------
-
+	// Worker threads for the systems, running between start() and clean()
+	JobSystem job_system_;
+	unsigned int job_worker_count_;
+	JobCounter frame_jobs_;					// jobs that have to finish before the render
 
-//-----------------------------------------------------------------------
-// Engine
-class Engine {
-private:
-    Engine() : paused_(false), current_msg_queue_(false) {}
-	Engine(const Engine&); // Singleton class, so keep the copy constructor private
-
-	engine::C_Timer timer_;
+#ifdef ENGINE_PROFILE
+	FrameProfiler profiler_;				// the last few hundred ticks, phase by phase
+	std::unique_ptr<FrameProfiler> render_profiler_;	// the render thread's frame, moved into profiler_ by waitForRender()
+#endif
 	double current_timestamp_;
     double deltaT_;
 
+	// Fixed time step, off while fixed_step_ is 0
+	double fixed_step_;
+	unsigned int max_fixed_steps_;		// most updates per tick, stops the catch up from spiralling
+	double step_accumulator_;
+	double interpolation_alpha_;
+
 	// Engine State
 	bool paused_;
 	// The current state of the engine is at the front of the list followed by previous states
 	std::list<EngineStatePtr> state_;		
 	EngineStatePtr queued_state_;			// The state to change to on the next tick()
+	EngineStatePtr loading_state_;			// being prepared by load_thread_, see loadState()
+	std::thread load_thread_;
+	std::vector<EngineState*> background_states_;	// covered BACKGROUND states, bottom of the stack first
+	std::size_t max_retained_states_;
+
+	// Pipelined rendering, see setPipelinedRender()
+	bool pipelined_render_;
+	std::thread render_thread_;
+	std::mutex render_mutex_;
+	std::condition_variable render_wake_;	// a frame was handed over, or the thread is to stop
+	std::condition_variable render_done_;
+	bool render_pending_;					// handed over and not finished yet
+	bool render_stopping_;
+	EngineStatePtr render_state_;			// the frame the render thread has, until waitForRender()
+	std::vector<EngineState*> render_background_;
+	double render_alpha_;
 	//-------------------------------------
 
 
 	// Message Components
-	// one list per message type (stored in the map)
-	typedef std::list<MsgListenerPtr> ListenerList;
-	// mapping of Message ID to listener list
-	typedef std::map<MessageType, ListenerList>	MessageListenerMap;
-	// An entry pair for the map
-	typedef std::pair<MessageType, ListenerList> MessageListenerMapPair;
-	// A map insertion result
-	typedef std::pair<MessageListenerMap::iterator, bool> MessageListenerMapIResult;
-
 	// queue of pending- or processing-events - double buffer queue, one takes new messages while one is being processed.
-	typedef std::list<MessagePtr> MessageQueue;
-	MessageQueue message_queue_[2];								
-	MessageListenerMap listener_map_;
+	// Each side has a lane per priority.  The queues hold the pool reference of each message until it is consumed.
+	typedef RingBuffer<Message*> MessageQueue;
+	MessageQueue message_queue_[2][PRIORITYCOUNT];
+	MessageQueue immediate_requeue_;						// unconsumed IMMEDIATE messages, held back until the dispatch ends
+	static const std::size_t DISPATCHCHUNK = 256;			// budgeted messages sent between clock reads
+	MessagePool message_pool_;
+	MessageInbox inbox_;									// messages posted from other threads
+	// Messages created and queued by systems updating on the job system.
+	// Each worker creates from a pool of its own, kept for the engine's
+	// life, and queues into a per lane inbox merged once the update is done.
+	std::mutex thread_pool_mutex_;
+	std::unordered_map<std::thread::id, std::unique_ptr<MessagePool> > thread_pools_;
+	unsigned long long serial_;								// tells the workers' pool caches engines apart
+	MessageInbox worker_queue_[PRIORITYCOUNT];
+	std::vector<std::pair<MessageChannel*, MsgPriority> > input_channels_;	// drained with the inbox
+	std::vector<std::pair<Message*, MsgPriority> > replay_inputs_;			// posts from a MessageReplay, drained first
+	std::vector<MessageChannel*> output_channels_;			// flushed at the end of every tick
+
+	// Messages queued for a later time, in ticks of schedule_resolution_ seconds
+	static const unsigned long long MAXSCHEDULETICK = 1ull << 62;
+	struct ScheduledMessage {
+		Message* msg;
+		MsgPriority priority;
+		ScheduledMessage() : msg(0), priority(NORMAL) {}
+		ScheduledMessage(Message* m, MsgPriority p) : msg(m), priority(p) {}
+	};
+	TimerWheel<ScheduledMessage> scheduled_;
+	double schedule_resolution_;
+	ListenerTable listener_table_;							// one listener set per message type
 	bool current_msg_queue_;								// the active queue 
-	ListenerList wildcard_listener_list_;					// The list of the wildcard listeners.
+
+	// Per tick limits on the NORMAL and DEFERRABLE lanes, 0 for no limit
+	std::size_t dispatch_budget_count_;
+	double dispatch_budget_time_;
+	std::size_t deferred_message_count_;					// left in the lanes by the last dispatch
+	ListenerSet wildcard_listeners_;						// The set of the wildcard listeners.
+	unsigned int next_listener_id_;							// last id given to a ListenerHandle, never reused
+
+	// Message recording, see MessageRecorder.h
+	MessageRecorder* recorder_;
+	unsigned int record_depth_;								// inside tick() or a recorded trigger, what is sent is not an input
+
+	// Batch delivery, the processing queue is grouped by type when any batch listener exists
+	struct BatchGroup {
+		ListenerSet* listeners;
+		MessageType type;
+		std::vector<const Message*> messages;
+		std::vector<unsigned char> consumed;
+	};
+	std::size_t batch_listener_count_;
+	std::vector<BatchGroup> batch_groups_;					// kept between ticks for the capacity
+	std::size_t batch_group_count_;							// groups in use this dispatch
+	std::vector<std::pair<unsigned int, unsigned int> > batch_slots_;	// per queued message, (group + 1, position), group 0 for none
+
+	// Limits on unconsumed messages
+	MessagePolicy default_policy_;
+	std::unordered_map<MessageType, MessagePolicy> message_policies_;
+	DeadLetterHandler dead_letter_handler_;
+	unsigned long dropped_message_count_;
+	unsigned long expired_message_count_;
+
+	// Coalescing, the newest queued message of each key per type and lane.
+	// Only messages on the active side are indexed, the index empties at the
+	// flip and takes in the messages carried over or requeued into it.
+	struct Coalescer {
+		CoalescePolicy policy;
+		std::unordered_map<unsigned long long, Message*> latest[PRIORITYCOUNT];
+	};
+	std::unordered_map<MessageType, Coalescer> coalescers_;
+	std::size_t superseded_count_[PRIORITYCOUNT];			// superseded messages in each active lane
+	unsigned long coalesced_message_count_;
+
+	// Per type bus counters, off until enableMessageStats()
+	bool message_stats_enabled_;
+	MessageStatsTable message_stats_;
+	long long nested_handler_time_;		// timed by sends inside the one being timed, see sendMessage()
 
 	void dispatchMessages();
+	void dispatchRange(MessageQueue& processing, std::size_t begin, std::size_t end, MessageQueue& requeue, MsgPriority lane);
+	void carryOver(MessageQueue& processing, std::size_t done, MessageQueue& pending, MsgPriority lane);
+	void gatherBatches(const MessageQueue& processing, std::size_t begin, std::size_t end);
+	void deliverBatches();
+	void runBatchListeners(ListenerSet& listeners, MessageBatch& batch);
+	MsgStatus sendMessage(const Message& msg, const unsigned char* batchConsumed);
+	MsgStatus deliverMessage(const Message& msg, std::size_t* deliveries, const unsigned char* batchConsumed);
+	void recordQueueWait(const Message& msg);
+	unsigned int nextListenerID();
+	void update(const EngineStatePtr& state);
+	bool shouldRequeue(Message& msg);
+	void coalesce(Message* msg, MsgPriority priority);
+	void coalesceOlder(Message* msg, MsgPriority priority);
+	void dropSuperseded(MessageQueue* lanes);
+	void releaseQueuedMessages();
+	MsgStatus enqueue(Message* msg, MsgPriority priority);
+	void queueDueMessages();
+	void readyState(const EngineStatePtr& s);
+	void evictState(EngineState* s);
+	void restack();
+	void updateBackground();
+	void render(const EngineStatePtr& current);
+	void renderFrame(const std::vector<EngineState*>& background, EngineState* current, const double& alpha);
+	void renderLoop();
+	void finishLoad();
+	void drainInbox();
+	void queueInput(Message* msg, MsgPriority priority);
+	void runTick(const double* deltaT);
+	MessagePool& getThreadPool();
+	void mergeWorkerQueues();
+	static unsigned long long nextSerial();
+	bool isRecording() const;
+	MsgStatus recordTrigger(const Message& msg);
+
+	// The typed handler list on the payload's type, NULL if the id is taken by another payload
+	template <class Payload>
+	TypedHandlerList<Payload>* getTypedHandlers(bool create) {
+		ListenerSet* listeners = create ? &listener_table_.get(MessageTypeOf<Payload>::value)
+			: listener_table_.find(MessageTypeOf<Payload>::value);
+		if (!listeners)
+			return 0;
+
+		TypedHandlerListBase* typed = listeners->getTyped();
+		if (!typed) {
+			if (!create)
+				return 0;
+			typed = new TypedHandlerList<Payload>();
+			listeners->setTyped(typed);
+		}
+		if (typed->getPayloadTag() != TypedHandlerList<Payload>::payloadTag())
+			return 0;
+		return static_cast<TypedHandlerList<Payload>*>(typed);
+	}
 
 public:
+	// Engines are independent of each other, so a process can run one per
+	// world with each driven by its own thread.  Everything on an Engine
+	// apart from the posting and the frame jobs belongs to that thread.
+	Engine() : job_worker_count_(0), current_timestamp_(0.0), deltaT_(0.0),
+		fixed_step_(0.0), max_fixed_steps_(0), step_accumulator_(0.0), interpolation_alpha_(1.0), paused_(false), max_retained_states_(0),
+		pipelined_render_(false), render_pending_(false), render_stopping_(false), render_alpha_(1.0), schedule_resolution_(0.001), current_msg_queue_(false),
+		dispatch_budget_count_(0), dispatch_budget_time_(0.0), deferred_message_count_(0), next_listener_id_(0), recorder_(0), record_depth_(0), batch_listener_count_(0), batch_group_count_(0), dropped_message_count_(0), expired_message_count_(0), coalesced_message_count_(0), message_stats_enabled_(false), nested_handler_time_(0) {
+		for (auto& count : superseded_count_)
+			count = 0;
+		serial_ = nextSerial();
+	}
+
+	// A process wide Engine for programs that only need the one
 	static Engine& instance() {
 		// c++11 standard enforces static variables only be instantiated once.
 		static Engine *instance = new Engine();
@@ -172,24 +264,103 @@ public:
     }
 
     void clean() {
+        cancelStateLoad();
+        setPipelinedRender(false);
+        job_system_.stop();
         if(!state_.empty()) {
 			for (auto& s : state_)
 				s->exit();
         }
 		state_.clear();
+        background_states_.clear();
         queued_state_ = 0;
-        listener_map_.clear();
-        wildcard_listener_list_.clear();
+        releaseQueuedMessages();
+        listener_table_.clear();
+        wildcard_listeners_.clear();
+        batch_listener_count_ = 0;
+        recorder_ = 0;
+        input_channels_.clear();
+        output_channels_.clear();
+        message_policies_.clear();
+        default_policy_ = MessagePolicy();
+        coalescers_.clear();
+        for (auto& count : superseded_count_)
+            count = 0;
+        dead_letter_handler_ = DeadLetterHandler();
     }
 
-	void start() { timer_.start(); current_timestamp_ = 0.0; }
+	// The thread calling start() owns the engine from then on, it has to be
+	// the one calling tick()
+	void start() {
+		message_pool_.bindToCurrentThread();
+		timer_.start();
+		current_timestamp_ = 0.0;
+		step_accumulator_ = 0.0;
+		pacer_.restart();
+		job_system_.start(job_worker_count_);
+	}
 	void pause() { paused_ = true; timer_.pause(); }
 	void unPause() { paused_ = false; timer_.unpause(); }
 
 	void tick();
+	// A tick of exactly deltaT seconds instead of the time since the last one,
+	// without any frame pacing.  For replays and tests.
+	void tick(const double& deltaT);
+
+	// The engine's job system, shared by every system instead of each starting
+	// its own threads.  The worker count is read by start(), 0 sizes the pool
+	// from the hardware.
+	JobSystem& getJobSystem() { return job_system_; }
+	void setJobWorkerCount(unsigned int count) { job_worker_count_ = count; }
+
+#ifdef ENGINE_PROFILE
+	FrameProfiler& getProfiler() { return profiler_; }
+#endif
+
+	// A job that tick() waits on after the update and before the render
+	void submitFrameJob(const Job& job) { job_system_.submit(job, &frame_jobs_); }
+	JobCounter& getFrameJobCounter() { return frame_jobs_; }
 	const double& getTimeStamp() { return current_timestamp_; }
     const double& getDeltaT() { return deltaT_; }
 
+	// Run onUpdate in steps of exactly step seconds, as many as the frame time
+	// covers up to maxSteps per tick.  Time beyond maxSteps is dropped.
+	// onRender gets the leftover fraction of a step as its alpha.
+	// A step of 0 goes back to one variable length update per tick.
+	void setFixedTimeStep(const double& step, unsigned int maxSteps = 5) {
+		fixed_step_ = step > 0.0 ? step : 0.0;
+		max_fixed_steps_ = maxSteps > 0 ? maxSteps : 1;
+		step_accumulator_ = 0.0;
+		interpolation_alpha_ = 1.0;
+	}
+	const double& getFixedTimeStep() const { return fixed_step_; }
+	const double& getInterpolationAlpha() const { return interpolation_alpha_; }
+
+	// Holds tick() to ticksPerSecond by waiting at its start for the rest of
+	// the last frame's period.  The wait sleeps until spinTime seconds before
+	// the deadline and spins from there, a spinTime of 0 only sleeps and
+	// leaves the core idle at the cost of the sleep's overshoot.  0 ticks
+	// per second runs as fast as the caller calls tick().
+	void setTargetTickRate(double ticksPerSecond, double spinTime = 0.001) { pacer_.setRate(ticksPerSecond, spinTime); }
+	double getTargetTickRate() const { return pacer_.getRate(); }
+	const FramePacingStats& getPacingStats() const { return pacer_.getStats(); }
+	void resetPacingStats() { pacer_.resetStats(); }
+
+	// Renders each tick on a thread of the engine's own while the next
+	// tick's update runs, so a tick costs the longer of the two rather than
+	// both.  tick() returns with its render still going, the next tick
+	// waits for it before handing over its own render and before any state
+	// change.  The render runs a tick behind and only sees what the update
+	// published to the state's snapshots, see EngineState::onRender().
+	// With ENGINE_PROFILE the render thread's samples show up in the next
+	// tick that collects them, the RENDER phase then only times the hand over.
+	// Off by default.
+	void setPipelinedRender(bool enable);
+	bool isPipelinedRender() const { return pipelined_render_; }
+	// Blocks until the render on the render thread has finished, e.g.
+	// before reading what it drew
+	void waitForRender();
+
 
 	EngineStatePtr getCurrentState() {
 		if (!state_.empty())
@@ -198,50 +369,250 @@ public:
 			return EngineStatePtr(NULL);
 	}
 
-	void pushState(EngineStatePtr s) {
-		if (!state_.empty()) {
-			state_.front()->exit();
-		}
-		s->enter();
-		state_.push_front(s);
-	}
+	// Prepares and activates the state first if that hasn't happened yet,
+	// waiting for a loadState() of it to finish.  The covered state exits
+	// and is then handled by its SuspendMode.
+	void pushState(EngineStatePtr s);
+	// The state uncovered by the pop is readied again and entered
+	void popState();
 
-	void popState() {
-		if (!state_.empty()) {
-			state_.front()->exit();
-			state_.pop_front();
-		}
-	}
+	// Covered states deeper than count below the current one are evicted
+	// whatever their SuspendMode, except BACKGROUND states.  0 for no limit.
+	void setMaxRetainedStates(std::size_t count) { max_retained_states_ = count; restack(); }
+	// For memory pressure, evicts every covered state that isn't BACKGROUND
+	void evictSuspendedStates();
 
 	void queueStateChange(EngineStatePtr state) {
 		queued_state_ = state;
 	}
 
+	// Runs the state's prepare() on a loader thread while the current state
+	// keeps ticking, then changes to it on the first tick() after prepare()
+	// returns.  One load at a time, false if another is still running.
+	bool loadState(EngineStatePtr state);
+	bool isLoadingState() const { return loading_state_ != 0; }
+	// 0 when nothing is loading
+	float getStateLoadProgress() const { return loading_state_ ? loading_state_->getLoadProgress() : 0.0f; }
+	// Asks prepare() to stop, waits for it and drops the load
+	void cancelStateLoad();
+
 	// Message Interface
-	enum MsgStatus {
-		NOTCONSUMED,
-		CONSUMED,
-		NOLISTENER,
-		SUCCESS
-	};
-    
-	MsgStatus queueMessage(MessagePtr msg);
-	MsgStatus triggerMessage(MessagePtr msg);
-	bool addWildCardListener(MsgListenerPtr l);
+	// Messages come out of the engine's pool and are recycled once consumed.
+	// Any other thread, a worker running a parallel onUpdate or a loader,
+	// gets a pool of its own.
+	template <class T, class... Args>
+	T* createMessage(Args&&... args) {
+		MessagePool& pool = message_pool_.isOwnerThread() ? message_pool_ : getThreadPool();
+		return pool.create<T>(std::forward<Args>(args)...);
+	}
+
+	// Takes over the caller's reference, even when the message is rejected.
+	// Off the tick() thread, from a parallel onUpdate, the messages are held
+	// until the update is done and SUCCESS only means they were taken.  The
+	// listener check and the recording happen when they are merged.
+	// triggerMessage() and queueMessageAt() belong to the tick() thread.
+	MsgStatus queueMessage(Message* msg, MsgPriority priority = NORMAL);
+	// Queues count messages in one call, returns how many were accepted.
+	std::size_t queueMessages(Message* const* msgs, std::size_t count, MsgPriority priority = NORMAL);
+
+	// Queues the message on the first tick whose time stamp reaches time,
+	// never earlier and at most one schedule resolution later.  A time
+	// already passed queues it now and returns 0, a NaN time drops the
+	// message and returns 0.  The listener check happens when it is
+	// queued.  Takes over the caller's reference.
+	TimerID queueMessageAt(Message* msg, const double& time, MsgPriority priority = NORMAL);
+	TimerID queueMessageAfter(Message* msg, const double& delay, MsgPriority priority = NORMAL) {
+		return queueMessageAt(msg, current_timestamp_ + delay, priority);
+	}
+	// Drops a message that hasn't come due yet, false if it already has
+	bool cancelScheduledMessage(TimerID id);
+	std::size_t getScheduledMessageCount() const { return scheduled_.size(); }
+	// The granularity of the scheduled times in seconds, 1ms by default.
+	// Only change it while nothing is scheduled.
+	void setScheduleResolution(const double& seconds) {
+		if (scheduled_.empty() && seconds > 0.0)
+			schedule_resolution_ = seconds;
+	}
+
+	// Caps the NORMAL and DEFERRABLE messages delivered per tick, by count
+	// and by time in seconds, whichever is reached first.  The count
+	// includes the IMMEDIATE and HIGH messages delivered the same tick.
+	// 0 for either means no limit.
+	void setDispatchBudget(std::size_t maxMessages, const double& maxSeconds) {
+		dispatch_budget_count_ = maxMessages;
+		dispatch_budget_time_ = maxSeconds > 0.0 ? maxSeconds : 0.0;
+	}
+	std::size_t getDeferredMessageCount() const { return deferred_message_count_; }
+
+	// Thread safe and lock-free, for posting from threads other than the one
+	// calling tick().  The messages must come from a MessagePool owned by the
+	// posting thread, createMessage() called on that thread hands out one,
+	// and are queued at the start of the next dispatch, in the NORMAL lane.
+	// Unlike queueMessage() from a worker, posts are recorded as inputs.
+	// Batching a thread's messages into one postMessages() call costs a
+	// single atomic operation for the whole block.
+	void postMessage(Message* msg) { inbox_.post(msg); }
+	void postMessages(Message* const* msgs, std::size_t count) { inbox_.post(msgs, count); }
+
+	// Channels to and from other Engines, see MessageChannel.h.  An input
+	// channel is drained into the priority lane at the start of each
+	// dispatch, an output channel gets the messages sent into it during a
+	// tick published as one batch when the tick ends.  The engine doesn't
+	// own the channels, each has one Engine at either end.
+	void addInputChannel(MessageChannel& channel, MsgPriority priority = NORMAL) {
+		input_channels_.push_back(std::make_pair(&channel, priority));
+	}
+	void removeInputChannel(MessageChannel& channel);
+	void addOutputChannel(MessageChannel& channel) { output_channels_.push_back(&channel); }
+	void removeOutputChannel(MessageChannel& channel);
+	MsgStatus triggerMessage(const Message& msg) { return recorder_ ? recordTrigger(msg) : sendMessage(msg, 0); }
+
+	// Logs the messages sent and the tick lengths into an open recorder,
+	// 0 to stop.  The engine doesn't own the recorder.
+	void setRecorder(MessageRecorder* recorder) { recorder_ = recorder; }
+	MessageRecorder* getRecorder() const { return recorder_; }
+	// For MessageReplay, queues a recorded post or channel message where
+	// the next tick drains its inputs, after the messages due that tick
+	void replayInput(Message* msg, MsgPriority priority) { replay_inputs_.push_back(std::make_pair(msg, priority)); }
+
+	// Typed messages, see TypedMessage.h.  Handlers get the payload directly,
+	// ahead of any MessageListeners on the same type.
+	template <class Payload, class... Args>
+	MsgStatus queue(Args&&... args) {
+		return queueMessage(createMessage<TypedMessage<Payload> >(current_timestamp_, std::forward<Args>(args)...));
+	}
+
+	template <class Payload, class... Args>
+	MsgStatus trigger(Args&&... args) {
+		return triggerMessage(TypedMessage<Payload>(current_timestamp_, std::forward<Args>(args)...));
+	}
+
+	// Returns 0 if the payload's type id is already used by another payload type
+	template <class Payload>
+	SubscriptionID subscribe(const typename TypedHandlerList<Payload>::Handler& handler) {
+		TypedHandlerList<Payload>* typed = getTypedHandlers<Payload>(true);
+		return typed ? typed->add(handler) : 0;
+	}
+
+	template <class Payload>
+	bool unsubscribe(SubscriptionID id) {
+		TypedHandlerList<Payload>* typed = getTypedHandlers<Payload>(false);
+		return typed ? typed->remove(id) : false;
+	}
+
+	// Listeners can be added and removed from inside onMessage.  A listener
+	// removed during a dispatch is not called again, and the engine keeps
+	// its reference until the dispatch is over.
+	ListenerHandle addWildCardListener(MsgListenerPtr l, const WildCardFilter& filter = WildCardFilter());
 	void deleteWildCardListener(MsgListenerPtr l) {
-		wildcard_listener_list_.remove(l);
+		wildcard_listeners_.remove(l);
 	}
     
     // The order of the listeners is not considered
-	bool addListener(MsgListenerPtr l, const MessageType& type);
+	ListenerHandle addListener(MsgListenerPtr l, const MessageType& type);
+	// Pairs count listeners to the type at once, growing the type's storage
+	// a single time.  handles, if given, gets one handle per listener, an
+	// invalid one for a listener already paired.  Returns how many were added.
+	std::size_t addListeners(const MsgListenerPtr* listeners, std::size_t count, const MessageType& type,
+		ListenerHandle* handles = 0);
+	// Sizes the type's storage for count listeners ahead of registering
+	// them, e.g. from a world's known listener counts
+	void reserveListeners(const MessageType& type, std::size_t count) { listener_table_.get(type).reserve(count); }
 
 	bool deleteListener(MsgListenerPtr l, const MessageType& type) {
-		MessageListenerMap::iterator mapItr = listener_map_.find(type);
-		if (mapItr != listener_map_.end()) {
-			mapItr->second.remove(l);
-			return true;
-		}
-		return false;
+		ListenerSet* listeners = listener_table_.find(type);
+		return listeners && listeners->remove(l);
+	}
+
+	// O(1), for either kind of listener
+	bool removeListener(const ListenerHandle& handle);
+
+	// Batch listeners get all of a dispatch's messages of their type at once,
+	// before any MessageListener sees them.
+	bool addBatchListener(BatchListenerPtr l, const MessageType& type) {
+		if (!listener_table_.get(type).addBatch(l))
+			return false;
+		++batch_listener_count_;
+		return true;
+	}
+
+	bool deleteBatchListener(BatchListenerPtr l, const MessageType& type) {
+		ListenerSet* listeners = listener_table_.find(type);
+		if (!listeners || !listeners->removeBatch(l))
+			return false;
+		--batch_listener_count_;
+		return true;
+	}
+
+	// Requeue limits for unconsumed messages, per type or for every type without its own
+	void setDefaultMessagePolicy(const MessagePolicy& policy) { default_policy_ = policy; }
+	void setMessagePolicy(const MessageType& type, const MessagePolicy& policy) {
+		message_policies_[type] = policy;
+	}
+	void clearMessagePolicy(const MessageType& type) { message_policies_.erase(type); }
+
+	// Coalesces the queued messages of a type, see CoalescePolicy.  Applied
+	// as messages are queued, so only one per key and lane is left to
+	// dispatch.  Messages only coalesce within their lane, a DEFERRABLE
+	// message never takes the place of a HIGH one with the same key.
+	// Messages carried over by the dispatch budget or requeued coalesce
+	// into the newer ones queued behind them.  IMMEDIATE messages are
+	// never coalesced.
+	void setCoalescePolicy(const MessageType& type, const CoalescePolicy& policy) {
+		Coalescer& coalescer = coalescers_[type];
+		coalescer.policy = policy;
+		for (auto& lane : coalescer.latest)
+			lane.clear();
+	}
+	void clearCoalescePolicy(const MessageType& type) { coalescers_.erase(type); }
+	unsigned long getCoalescedMessageCount() const { return coalesced_message_count_; }
+
+	// Typed messages keyed on their payload, key is unsigned long long (const Payload&)
+	template <class Payload, class KeyFunc>
+	void coalesceLatest(KeyFunc key) {
+		setCoalescePolicy(MessageTypeOf<Payload>::value, CoalescePolicy(
+			[key](const Message& msg) -> unsigned long long {
+				return key(static_cast<const TypedMessage<Payload>&>(msg).getPayload());
+			}));
+	}
+
+	// As coalesceLatest, merge is void (const Payload& older, Payload& newer)
+	template <class Payload, class KeyFunc, class MergeFunc>
+	void coalesceMerge(KeyFunc key, MergeFunc merge) {
+		setCoalescePolicy(MessageTypeOf<Payload>::value, CoalescePolicy(
+			[key](const Message& msg) -> unsigned long long {
+				return key(static_cast<const TypedMessage<Payload>&>(msg).getPayload());
+			},
+			[merge](const Message& older, Message& newer) {
+				merge(static_cast<const TypedMessage<Payload>&>(older).getPayload(),
+					static_cast<TypedMessage<Payload>&>(newer).getPayload());
+			}));
+	}
+	const MessagePolicy& getMessagePolicy(const MessageType& type) const {
+		if (message_policies_.empty())
+			return default_policy_;
+		std::unordered_map<MessageType, MessagePolicy>::const_iterator itr = message_policies_.find(type);
+		return itr == message_policies_.end() ? default_policy_ : itr->second;
+	}
+
+	void setDeadLetterHandler(const DeadLetterHandler& handler) { dead_letter_handler_ = handler; }
+	unsigned long getDroppedMessageCount() const { return dropped_message_count_; }
+	unsigned long getExpiredMessageCount() const { return expired_message_count_; }
+	void resetDropCounts() { dropped_message_count_ = 0; expired_message_count_ = 0; }
+
+	// Per type counts, fan out, listener time and queue wait.  Cheap enough to
+	// leave on, the cost is an array index per message plus two clock reads
+	// per triggerMessage.
+	void enableMessageStats(bool enable) { message_stats_enabled_ = enable; }
+	bool isMessageStatsEnabled() const { return message_stats_enabled_; }
+	const MessageStats* getMessageStats(const MessageType& type) const { return message_stats_.find(type); }
+	const MessageStatsTable& getMessageStatsTable() const { return message_stats_; }
+	void resetMessageStats() { message_stats_.clear(); }
+
+	// Message types below limit get a directly indexed listener set, the
+	// rest are hashed.  Has to be set before any listener is added.
+	bool setDenseMessageTypeLimit(std::size_t limit) {
+		return listener_table_.setDenseLimit(limit);
 	}
 }; // class Engine
     
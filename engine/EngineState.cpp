@@ -0,0 +1,500 @@
+/*=========================================================================
+/ James McCormick - EngineState.cpp
+/ The systems and the states that run them
+/==========================================================================*/
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include "EngineState.h"
+
+namespace engine {
+
+//========================================================================
+// EngineSystem implemenation
+//========================================================================
+
+//-----------------------------------------------------------------------
+// activityChanged - Protected EngineSystem
+// Description
+//		Tells the states running the system to recheck whether it is
+//		paused or visible before their next loop.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void EngineSystem::activityChanged() {
+	for (auto owner : owners_) {
+		owner->update_dirty_.store(true, std::memory_order_relaxed);
+		owner->render_dirty_.store(true, std::memory_order_relaxed);
+		owner->schedule_dirty_.store(true, std::memory_order_relaxed);
+	}
+}
+
+
+
+//========================================================================
+// EngineState implemenation
+//========================================================================
+
+EngineState::~EngineState() {
+	for (auto& slot : slots_)
+		if (slot.system)
+			dropOwner(slot.system);
+}
+
+
+void EngineState::dropOwner(EngineSystem* system) {
+	std::vector<EngineState*>& owners = system->owners_;
+	owners.erase(std::remove(owners.begin(), owners.end(), this), owners.end());
+}
+
+
+//-----------------------------------------------------------------------
+// addSystem - Private EngineState
+// Description
+//		Gives the system a slot unless it has one, then adds its key to
+//		each of the lists it isn't in yet.
+//
+// Arguments:	shared - the reference to keep, empty for an emplaced system
+//				system - the system
+//				lists - the loops it joins
+//				order - its ordering key in those loops
+// Returns:		the system's handle
+//-----------------------------------------------------------------------
+EngineState::SystemHandle EngineState::addSystem(const EngineSystemPtr& shared, EngineSystem* system, SystemLists lists, int order) {
+	unsigned int index;
+	std::unordered_map<EngineSystem*, unsigned int>::iterator found = slot_of_.find(system);
+	if (found != slot_of_.end())
+		index = found->second;
+	else {
+		if (free_slot_ != ~0u) {
+			index = free_slot_;
+			free_slot_ = slots_[index].next_free;
+		}
+		else {
+			index = (unsigned int)slots_.size();
+			SystemSlot slot = SystemSlot();
+			slot.generation = 1;
+			slots_.push_back(slot);
+		}
+
+		SystemSlot& slot = slots_[index];
+		slot.shared = shared;
+		slot.system = system;
+		slot.update_key = NOKEY;
+		slot.render_key = NOKEY;
+		slot_of_[system] = index;
+		system->owners_.push_back(this);
+		++system_count_;
+	}
+
+	SystemSlot& slot = slots_[index];
+	if ((lists & UPDATELIST) && slot.update_key == NOKEY) {
+		slot.update_key = addKey(update_keys_, update_unsorted_, index, order);
+		update_dirty_.store(true, std::memory_order_relaxed);
+	}
+	if ((lists & RENDERLIST) && slot.render_key == NOKEY) {
+		slot.render_key = addKey(render_keys_, render_unsorted_, index, order);
+		render_dirty_.store(true, std::memory_order_relaxed);
+	}
+	schedule_dirty_.store(true, std::memory_order_relaxed);
+	return ((SystemHandle)slot.generation << 32) | (index + 1);
+}
+
+
+// Keys pushed in order, the usual case, need no sort
+std::size_t EngineState::addKey(std::vector<OrderedSystem>& keys, bool& unsorted, unsigned int slot, int order) {
+	if (!keys.empty() && order < keys.back().order)
+		unsorted = true;
+	OrderedSystem key = { slots_[slot].system, order, next_sequence_++, slot };
+	keys.push_back(key);
+	return keys.size() - 1;
+}
+
+
+EngineState::SystemHandle EngineState::getSystemHandle(EngineSystem* system) const {
+	std::unordered_map<EngineSystem*, unsigned int>::const_iterator found = slot_of_.find(system);
+	if (found == slot_of_.end())
+		return 0;
+	return ((SystemHandle)slots_[found->second].generation << 32) | (found->second + 1);
+}
+
+
+EngineSystem* EngineState::getSystem(SystemHandle handle) const {
+	unsigned int index = (unsigned int)(handle & 0xFFFFFFFFu) - 1;
+	if (handle == 0 || index >= slots_.size() || slots_[index].generation != (unsigned int)(handle >> 32))
+		return 0;
+	return slots_[index].system;
+}
+
+
+bool EngineState::removeSystem(SystemHandle handle) {
+	if (!getSystem(handle))
+		return false;
+
+	// The loops walk raw pointers, the system can't go until they are done.
+	// A parallel update gets here from several workers at once.
+	if (iterating_) {
+		std::lock_guard<std::mutex> lock(deferred_mutex_);
+		deferred_removals_.push_back(handle);
+		return true;
+	}
+	unlinkSystem((unsigned int)(handle & 0xFFFFFFFFu) - 1);
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+// unlinkSystem - Private EngineState
+// Description
+//		Clears the system's keys in place, drops the dependencies declared
+//		on it and frees its slot.  A system still on the render thread is
+//		kept until the render is done.
+//
+// Arguments:	index - the system's slot
+// Returns:		None.
+//-----------------------------------------------------------------------
+void EngineState::unlinkSystem(unsigned int index) {
+	SystemSlot& slot = slots_[index];
+	EngineSystem* system = slot.system;
+
+	if (slot.update_key != NOKEY) {
+		update_keys_[slot.update_key].system = 0;
+		update_holes_ = true;
+		update_dirty_.store(true, std::memory_order_relaxed);
+	}
+	if (slot.render_key != NOKEY) {
+		render_keys_[slot.render_key].system = 0;
+		render_holes_ = true;
+		render_dirty_.store(true, std::memory_order_relaxed);
+	}
+
+	// A later system at the same address mustn't pick these up.  Only
+	// systems named in a dependency or an access pay for the scan.
+	if (!declared_.empty() && declared_.erase(system)) {
+		update_edges_.erase(std::remove_if(update_edges_.begin(), update_edges_.end(),
+			[system](const std::pair<EngineSystem*, EngineSystem*>& e) { return e.first == system || e.second == system; }),
+			update_edges_.end());
+		update_access_.erase(std::remove_if(update_access_.begin(), update_access_.end(),
+			[system](const SystemAccess& a) { return a.system == system; }), update_access_.end());
+	}
+	schedule_dirty_.store(true, std::memory_order_relaxed);
+
+	dropOwner(system);
+	slot_of_.erase(system);
+	if (render_pipelined_ && slot.shared)
+		retired_systems_.push_back(slot.shared);
+	slot.shared.reset();
+	slot.system = 0;
+	++slot.generation;
+	slot.next_free = free_slot_;
+	free_slot_ = index;
+	--system_count_;
+}
+
+
+// Once the last loop is over, the removals made inside it
+void EngineState::removeDeferred() {
+	std::vector<SystemHandle> removals;
+	removals.swap(deferred_removals_);
+	for (auto handle : removals)
+		removeSystem(handle);
+	removals.clear();
+	deferred_removals_.swap(removals);		// keeps the capacity
+}
+
+
+namespace {
+	struct ByKey {
+		template <class Key>
+		bool operator()(const Key& a, const Key& b) const {
+			return a.order != b.order ? a.order < b.order : a.sequence < b.sequence;
+		}
+	};
+	struct IsRemoved {
+		template <class Key>
+		bool operator()(const Key& key) const { return key.system == 0; }
+	};
+}
+
+
+//-----------------------------------------------------------------------
+// rebuildUpdateOrder - Private EngineState
+// Description
+//		Closes up the keys of removed systems and sorts the update systems
+//		by their order keys if they changed, then fills the array the
+//		update loop walks with the unpaused ones.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void EngineState::rebuildUpdateOrder() {
+	update_dirty_.store(false, std::memory_order_relaxed);
+	if (update_holes_ || update_unsorted_) {
+		if (update_holes_)
+			update_keys_.erase(std::remove_if(update_keys_.begin(), update_keys_.end(), IsRemoved()), update_keys_.end());
+		if (update_unsorted_)
+			std::sort(update_keys_.begin(), update_keys_.end(), ByKey());
+		update_holes_ = false;
+		update_unsorted_ = false;
+		for (std::size_t i = 0; i < update_keys_.size(); ++i)
+			slots_[update_keys_[i].slot].update_key = i;
+	}
+
+	update_order_.clear();
+	for (auto& key : update_keys_)
+		if (!key.system->isPaused())
+			update_order_.push_back(key.system);
+}
+
+
+void EngineState::rebuildRenderOrder() {
+	render_dirty_.store(false, std::memory_order_relaxed);
+	if (render_holes_ || render_unsorted_) {
+		if (render_holes_)
+			render_keys_.erase(std::remove_if(render_keys_.begin(), render_keys_.end(), IsRemoved()), render_keys_.end());
+		if (render_unsorted_)
+			std::sort(render_keys_.begin(), render_keys_.end(), ByKey());
+		render_holes_ = false;
+		render_unsorted_ = false;
+		for (std::size_t i = 0; i < render_keys_.size(); ++i)
+			slots_[render_keys_[i].slot].render_key = i;
+	}
+
+	render_order_.clear();
+	for (auto& key : render_keys_)
+		if (key.system->isVisible())
+			render_order_.push_back(key.system);
+}
+
+
+//-----------------------------------------------------------------------
+// beginRender - Private EngineState
+// Description
+//		Called by the Engine between the update and the render, on the
+//		tick() thread.  Swaps the snapshots if the state was updated and
+//		brings the render array up to date, as a pipelined onRender
+//		leaves it alone.
+//
+// Arguments:	pipelined - whether onRender runs on the render thread
+// Returns:		None.
+//-----------------------------------------------------------------------
+void EngineState::beginRender(bool pipelined) {
+	if (snapshot_pending_) {
+		snapshot_pending_ = false;
+		for (auto snapshot : snapshots_)
+			snapshot->swap();
+	}
+	if (render_dirty_.load(std::memory_order_relaxed))
+		rebuildRenderOrder();
+	render_pipelined_ = pipelined;
+}
+
+
+// Once the render thread is done with the state
+void EngineState::endRender() {
+	render_pipelined_ = false;
+	retired_systems_.clear();
+}
+
+
+//-----------------------------------------------------------------------
+// buildSchedule - Private EngineState
+// Description
+//		Turns the explicit dependencies and the declared resource access
+//		into a dependency graph over the sorted update order.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void EngineState::buildSchedule() {
+	schedule_dirty_.store(false, std::memory_order_relaxed);
+	const std::size_t count = update_order_.size();
+
+	schedule_.assign(count, UpdateNode());
+	std::unordered_map<EngineSystem*, std::size_t> nodeOf;
+	for (std::size_t i = 0; i < count; ++i) {
+		schedule_[i].system = update_order_[i];
+		schedule_[i].dependency_count = 0;
+		nodeOf[update_order_[i]] = i;
+	}
+
+	// The explicit edges by the node that waits, and each system's
+	// resource use with a write covering a read of the same resource,
+	// both sorted by node
+	const std::size_t NONE = ~(std::size_t)0;
+	std::vector<std::pair<std::size_t, std::size_t> > waits;		// (after, before)
+	waits.reserve(update_edges_.size());
+	for (auto& e : update_edges_) {
+		std::unordered_map<EngineSystem*, std::size_t>::iterator after = nodeOf.find(e.first);
+		std::unordered_map<EngineSystem*, std::size_t>::iterator before = nodeOf.find(e.second);
+		if (after != nodeOf.end() && before != nodeOf.end())
+			waits.push_back(std::make_pair(after->second, before->second));
+	}
+	std::sort(waits.begin(), waits.end());
+
+	struct NodeAccess {
+		std::size_t node;
+		ResourceID resource;
+		ResourceAccess access;
+		bool operator<(const NodeAccess& other) const {
+			if (node != other.node)
+				return node < other.node;
+			if (resource != other.resource)
+				return resource < other.resource;
+			return access > other.access;			// WRITE first
+		}
+	};
+	std::vector<NodeAccess> uses;
+	uses.reserve(update_access_.size());
+	for (auto& a : update_access_) {
+		std::unordered_map<EngineSystem*, std::size_t>::iterator node = nodeOf.find(a.system);
+		if (node != nodeOf.end()) {
+			NodeAccess use = { node->second, a.resource, a.access };
+			uses.push_back(use);
+		}
+	}
+	std::sort(uses.begin(), uses.end());
+
+	// Walking the update order, a system waits for the last writer of each
+	// resource it touches and a writer also for the readers since then.
+	// Those are enough to keep every conflicting pair in order.  The
+	// stamp keeps a node from being counted twice as a dependency.
+	struct ResourceUse {
+		std::size_t writer;
+		std::vector<std::size_t> readers;		// since the last write
+	};
+	std::unordered_map<ResourceID, ResourceUse> resources;
+	std::vector<std::size_t> stamp(count, NONE);
+	std::size_t w = 0;
+	std::size_t u = 0;
+	for (std::size_t node = 0; node < count; ++node) {
+		auto dependOn = [this, &stamp, node](std::size_t before) {
+			if (before != node && stamp[before] != node) {
+				stamp[before] = node;
+				schedule_[before].dependents.push_back(node);
+				++schedule_[node].dependency_count;
+			}
+		};
+
+		for (; w < waits.size() && waits[w].first == node; ++w)
+			dependOn(waits[w].second);
+
+		for (; u < uses.size() && uses[u].node == node; ++u) {
+			if (u > 0 && uses[u - 1].node == node && uses[u - 1].resource == uses[u].resource)
+				continue;			// the write already covered it
+			std::unordered_map<ResourceID, ResourceUse>::iterator found = resources.find(uses[u].resource);
+			if (found == resources.end()) {
+				found = resources.insert(std::make_pair(uses[u].resource, ResourceUse())).first;
+				found->second.writer = NONE;
+			}
+			ResourceUse& use = found->second;
+			if (use.writer != NONE)
+				dependOn(use.writer);
+			if (uses[u].access == WRITE) {
+				for (auto reader : use.readers)
+					dependOn(reader);
+				use.readers.clear();
+				use.writer = node;
+			}
+			else
+				use.readers.push_back(node);
+		}
+	}
+
+	// Kahn's walk, if it can't reach every node the explicit edges made a cycle
+	std::vector<int> remaining(count);
+	std::vector<std::size_t> ready;
+	for (std::size_t i = 0; i < count; ++i) {
+		remaining[i] = schedule_[i].dependency_count;
+		if (remaining[i] == 0)
+			ready.push_back(i);
+	}
+	std::size_t visited = 0;
+	while (!ready.empty()) {
+		std::size_t node = ready.back();
+		ready.pop_back();
+		++visited;
+		for (auto d : schedule_[node].dependents)
+			if (--remaining[d] == 0)
+				ready.push_back(d);
+	}
+	schedule_valid_ = visited == count;
+
+	// Reported once, not on every rebuild while the cycle stays
+	if (schedule_valid_)
+		cycle_reported_ = false;
+	else if (!cycle_reported_) {
+		cycle_reported_ = true;
+		std::vector<EngineSystem*> stuck;
+		for (std::size_t i = 0; i < count; ++i)
+			if (remaining[i] > 0)
+				stuck.push_back(schedule_[i].system);
+		onUpdateCycle(stuck);
+	}
+
+	pending_.reset(new std::atomic<int>[count]);
+}
+
+
+void EngineState::onUpdateCycle(const std::vector<EngineSystem*>& systems) {
+	std::cerr << "EngineState: the update dependencies form a cycle, updating serially. Left unscheduled:";
+	for (auto sys : systems)
+		std::cerr << ' ' << sys->getName();
+	std::cerr << std::endl;
+}
+
+
+//-----------------------------------------------------------------------
+// parallelUpdate - Private EngineState
+// Description
+//		Runs the update list on the job system, each system as soon as
+//		everything it depends on is done.  Falls back to the serial loop
+//		when the dependencies form a cycle.
+//
+// Arguments:	deltaT - the time step
+// Returns:		None.
+//-----------------------------------------------------------------------
+void EngineState::parallelUpdate(const double& deltaT) {
+	if (schedule_dirty_.load(std::memory_order_relaxed))
+		buildSchedule();
+
+	if (!schedule_valid_) {
+		serialUpdate(deltaT);
+		return;
+	}
+
+	for (std::size_t i = 0; i < schedule_.size(); ++i)
+		pending_[i].store(schedule_[i].dependency_count, std::memory_order_relaxed);
+
+	// The jobs run on other threads, so they are handed the tick's profiler
+	FrameProfiler* profiler = FrameProfiler::current();
+	JobCounter counter;
+	for (std::size_t i = 0; i < schedule_.size(); ++i) {
+		if (schedule_[i].dependency_count == 0)
+			job_system_->submit([this, i, &deltaT, &counter, profiler] {
+				runUpdateNode(i, deltaT, counter, profiler);
+			}, &counter);
+	}
+	job_system_->wait(counter);
+}
+
+
+void EngineState::runUpdateNode(std::size_t node, const double& deltaT, JobCounter& counter, FrameProfiler* profiler) {
+	{
+		EngineSystem* sys = schedule_[node].system;
+		ENGINE_PROFILE_SCOPE(profiler, "update", sys->getName(), sys);
+		sys->onUpdate(deltaT);
+	}
+
+	// Dependents are submitted before this job finishes, so the counter can't hit zero early
+	for (auto d : schedule_[node].dependents) {
+		if (pending_[d].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			job_system_->submit([this, d, &deltaT, &counter, profiler] {
+				runUpdateNode(d, deltaT, counter, profiler);
+			}, &counter);
+	}
+}
+
+}  // namespace engine
@@ -0,0 +1,416 @@
+/*=========================================================================
+/ James McCormick - EngineState.h
+/ The systems and the states that run them
+/==========================================================================*/
+
+#ifndef _ENGINESTATE_
+#define _ENGINESTATE_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "JobSystem.h"
+#include "Profiler.h"
+#include "RenderSnapshot.h"
+#include "SystemArena.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// The System interface
+//typedef unsigned long SystemID;	// A globally unique system ID number   TODO - ?needed?
+class EngineState;
+
+// The states running a system only call it while it is unpaused (update)
+// and visible (render).  They are told when either changes, so overrides
+// of pause(), unPause() and setVisibility() have to call the base
+// version, and subclasses that set paused_ or visible_ directly have to
+// call activityChanged().  Only change them from the thread calling tick()
+// or, during a parallel update, from the system's own onUpdate.
+class EngineSystem {
+private:
+	friend class EngineState;
+	std::vector<EngineState*> owners_;		// states with this system in a loop, never copied
+
+protected:
+	bool paused_;
+	bool visible_;
+
+	void activityChanged();
+
+public:
+	EngineSystem() : paused_(false), visible_(true) {}
+	EngineSystem(const EngineSystem& other) : paused_(other.paused_), visible_(other.visible_) {}
+	EngineSystem& operator=(const EngineSystem& other) {
+		paused_ = other.paused_;
+		visible_ = other.visible_;
+		activityChanged();
+		return *this;
+	}
+	virtual ~EngineSystem() {}
+	virtual void pause() { paused_ = true; activityChanged(); }
+	virtual void unPause() { paused_ = false; activityChanged(); }
+	virtual bool isVisible() const { return visible_; }
+	virtual bool isPaused() { return paused_; }
+	virtual void setVisibility(bool b) { visible_ = b; activityChanged(); }
+
+	// Used to label the system in profiler traces
+	virtual const char* getName() const { return "EngineSystem"; }
+
+	// alpha is how far the render falls between the last two fixed updates,
+	// always 1 when the engine runs a variable time step
+	virtual void onRender(const double& alpha) = 0;
+	virtual void onUpdate(const double& elapsedTime) = 0;
+};
+typedef std::shared_ptr<EngineSystem> EngineSystemPtr;
+//-----------------------------------------------------------------------
+
+
+
+//-----------------------------------------------------------------------
+// The EngineState interface
+//typedef unsigned StateID;  // A globally unique state ID number    TODO - ?needed?
+class EngineState {
+public:
+	// Anything systems share that the update schedule has to order access to
+	typedef unsigned int ResourceID;
+	enum ResourceAccess {
+		READ,
+		WRITE
+	};
+
+	// A system's entry in the state, 0 is never a valid handle.  A handle
+	// goes stale once its system is removed, even if the slot is reused.
+	typedef unsigned long long SystemHandle;
+
+	// Which loops a system created by emplaceSystem() joins
+	enum SystemLists {
+		UPDATELIST = 1,
+		RENDERLIST = 2,
+		BOTHLISTS = UPDATELIST | RENDERLIST
+	};
+
+	// What a state does while another state is on top of it
+	enum SuspendMode {
+		RETAINED,		// kept as it is, neither updated nor rendered
+		BACKGROUND,		// keeps updating underneath, e.g. gameplay under a pause menu
+		EVICTED			// drops its resources, prepared again before it is next entered
+	};
+
+	// How far a state has come through its loading, see Engine::loadState()
+	enum LoadPhase {
+		UNLOADED,
+		PREPARING,
+		PREPARED,
+		ACTIVATED
+	};
+
+private:
+	friend class Engine;
+	friend class EngineSystem;
+
+	std::atomic<int> load_phase_;
+	std::atomic<float> load_progress_;
+	std::atomic<bool> load_cancelled_;
+
+	SuspendMode suspend_mode_;
+	unsigned int background_interval_;		// BACKGROUND, ticks per update
+	bool render_covered_;					// BACKGROUND, also rendered underneath
+	unsigned int background_ticks_;			// kept by the Engine while covered
+	double background_time_;
+
+	typedef std::vector<EngineSystemPtr> SystemList;
+	SystemArena<EngineSystem> arena_;		// the systems the state owns outright
+
+	// The registry, one slot per system whichever lists it is in.  Slots
+	// are recycled through a free list and know where their keys are, so
+	// adding and removing a system never searches.
+	static const std::size_t NOKEY = ~(std::size_t)0;
+	struct SystemSlot {
+		EngineSystemPtr shared;				// keeps a shared system alive, empty for emplaced ones
+		EngineSystem* system;				// 0 while the slot is free
+		std::size_t update_key;				// index into update_keys_, NOKEY when not updated
+		std::size_t render_key;
+		unsigned int generation;			// bumped on removal, stale handles miss
+		unsigned int next_free;
+	};
+	std::vector<SystemSlot> slots_;
+	unsigned int free_slot_;
+	std::size_t system_count_;
+	std::unordered_map<EngineSystem*, unsigned int> slot_of_;	// for the calls taking a system
+	unsigned int iterating_;						// loops running on the tick() thread
+	std::vector<SystemHandle> deferred_removals_;	// removed while a loop was running
+	std::mutex deferred_mutex_;						// a parallel update removes from the workers
+
+	// Every system with its ordering key.  The loops run over the raw
+	// pointer arrays of the active systems, sorted by key then by insertion,
+	// rebuilt when a system is added, removed, paused or hidden.  The two
+	// loops are rebuilt apart, a pipelined render walks its array on the
+	// render thread while the update rebuilds its own.  A removed system
+	// leaves a hole in its keys that the next rebuild closes up.
+	struct OrderedSystem {
+		EngineSystem* system;				// 0 once removed
+		int order;
+		unsigned int sequence;
+		unsigned int slot;
+	};
+	std::vector<OrderedSystem> update_keys_;
+	std::vector<OrderedSystem> render_keys_;
+	std::vector<EngineSystem*> update_order_;		// unpaused systems only
+	std::vector<EngineSystem*> render_order_;		// visible systems only
+	unsigned int next_sequence_;
+	bool update_unsorted_;							// keys need sorting
+	bool render_unsorted_;
+	bool update_holes_;								// keys of removed systems to drop
+	bool render_holes_;
+	// Arrays need refilling.  Atomic for a parallel update's pause() and
+	// setVisibility() on the workers, relaxed since the update's join
+	// orders them before the tick() thread reads them.
+	std::atomic<bool> update_dirty_;
+	std::atomic<bool> render_dirty_;
+
+	// Render data published by the update, swapped by the Engine between
+	// a tick's update and its render
+	std::vector<SnapshotBufferBase*> snapshots_;
+	bool snapshot_pending_;							// updated since the last swap
+	bool render_pipelined_;							// being rendered on the Engine's render thread
+	SystemList retired_systems_;					// deleted while render_pipelined_, kept for the render
+
+	// Parallel update, only used once a job system is set
+	struct SystemAccess {
+		EngineSystem* system;
+		ResourceID resource;
+		ResourceAccess access;
+	};
+	struct UpdateNode {
+		EngineSystem* system;
+		std::vector<std::size_t> dependents;	// nodes that wait on this one
+		int dependency_count;
+	};
+
+	JobSystem* job_system_;
+	std::vector<std::pair<EngineSystem*, EngineSystem*> > update_edges_;	// (system, runs after)
+	std::vector<SystemAccess> update_access_;
+	std::unordered_set<EngineSystem*> declared_;		// named in the edges or the access
+	std::vector<UpdateNode> schedule_;
+	std::unique_ptr<std::atomic<int>[]> pending_;		// unfinished dependencies per node
+	std::atomic<bool> schedule_dirty_;
+	bool schedule_valid_;								// false when the dependencies form a cycle
+	bool cycle_reported_;								// onUpdateCycle() called for the current cycle
+
+	void rebuildUpdateOrder();
+	void rebuildRenderOrder();
+	void beginRender(bool pipelined);
+	void endRender();
+	SystemHandle addSystem(const EngineSystemPtr& shared, EngineSystem* system, SystemLists lists, int order);
+	std::size_t addKey(std::vector<OrderedSystem>& keys, bool& unsorted, unsigned int slot, int order);
+	void unlinkSystem(unsigned int slot);
+	void removeDeferred();
+	void dropOwner(EngineSystem* system);
+
+	void serialUpdate(const double& deltaT) {
+		for (auto sys : update_order_) {
+			ENGINE_PROFILE_SCOPE(FrameProfiler::current(), "update", sys->getName(), sys);
+			sys->onUpdate(deltaT);
+		}
+	}
+	void renderSystems(const double& alpha) {
+		for (auto sys : render_order_) {
+			ENGINE_PROFILE_SCOPE(FrameProfiler::current(), "render", sys->getName(), sys);
+			sys->onRender(alpha);
+		}
+	}
+	void endIteration() {
+		if (--iterating_ == 0 && !deferred_removals_.empty())
+			removeDeferred();
+	}
+
+	void buildSchedule();
+	void parallelUpdate(const double& deltaT);
+	void runUpdateNode(std::size_t node, const double& deltaT, JobCounter& counter, FrameProfiler* profiler);
+
+protected:
+
+	// Takes the system out of both loops, see removeSystem()
+	inline virtual void deleteSystem(const EngineSystemPtr& ptr) {
+		removeSystem(getSystemHandle(ptr.get()));
+	}
+
+	// Systems with a lower order run first, equal orders in the order they
+	// were added.  pushBack uses order 0.  A system is in each list at most
+	// once, pushing it again only returns its handle.
+	inline SystemHandle pushBackUpdate(const EngineSystemPtr& ptr, int order = 0) {
+		return addSystem(ptr, ptr.get(), UPDATELIST, order);
+	}
+
+	inline SystemHandle pushBackRender(const EngineSystemPtr& ptr, int order = 0) {
+		return addSystem(ptr, ptr.get(), RENDERLIST, order);
+	}
+
+	// Takes the system out of both loops, the rest keep their order.  The
+	// call itself is O(1) unless the system has update dependencies or
+	// declared access, which are scanned for it.  Each loop then closes up
+	// its holes, without sorting, once before its next pass.  Called from
+	// inside the state's update or render loop, e.g. by a system removing
+	// itself, the removal waits until the loop is over and the system
+	// still finishes the pass.  A shared system is released, an emplaced
+	// one stays in the arena until the state goes.  False for a stale
+	// handle.
+	bool removeSystem(SystemHandle handle);
+	// 0 if the system isn't in the state
+	SystemHandle getSystemHandle(EngineSystem* system) const;
+	EngineSystem* getSystem(SystemHandle handle) const;
+	std::size_t getSystemCount() const { return system_count_; }
+
+	// Builds a system in the state's own storage, next to the other
+	// emplaced systems and without a reference count.  It lives as long
+	// as the state and can't be deleted before it.
+	template <class T, class... Args>
+	T* emplaceSystem(SystemLists lists, int order, Args&&... args) {
+		T* system = arena_.template create<T>(std::forward<Args>(args)...);
+		addSystem(EngineSystemPtr(), system, lists, order);
+		return system;
+	}
+
+	// Opt in to running the update systems as jobs, NULL goes back to the
+	// serial loop.  Systems with no ordering between them may run at the
+	// same time, the ordering comes from the two calls below.
+	// From a parallel onUpdate a system may remove systems, deleted once
+	// the loop is done, and pause or hide them, picked up next tick.  It
+	// may create and queue messages, the Engine gives each worker a pool
+	// and merges their queues on its own thread once the update is done,
+	// but not trigger or schedule them.  Adding systems or changing the
+	// ordering has to wait for the tick() thread.
+	void setJobSystem(JobSystem* jobs) { job_system_ = jobs; }
+
+	// system's onUpdate starts only after runsAfter's has returned
+	void addUpdateDependency(EngineSystem* system, EngineSystem* runsAfter) {
+		update_edges_.push_back(std::make_pair(system, runsAfter));
+		declared_.insert(system);
+		declared_.insert(runsAfter);
+		schedule_dirty_.store(true, std::memory_order_relaxed);
+	}
+	void addUpdateDependency(const EngineSystemPtr& system, const EngineSystemPtr& runsAfter) {
+		addUpdateDependency(system.get(), runsAfter.get());
+	}
+
+	// Two systems touching the same resource, with at least one writing it,
+	// keep their update order.  Readers of a resource run side by side.
+	void declareAccess(EngineSystem* system, ResourceID resource, ResourceAccess access) {
+		SystemAccess entry = { system, resource, access };
+		update_access_.push_back(entry);
+		declared_.insert(system);
+		schedule_dirty_.store(true, std::memory_order_relaxed);
+	}
+	void declareAccess(const EngineSystemPtr& system, ResourceID resource, ResourceAccess access) {
+		declareAccess(system.get(), resource, access);
+	}
+	// Called once when the explicit dependencies turn out to form a cycle,
+	// with the systems that couldn't be scheduled, and the update runs
+	// serially until the cycle is gone.  Writes them to std::cerr.
+	virtual void onUpdateCycle(const std::vector<EngineSystem*>& systems);
+
+	// Swapped by the Engine after every tick that updates the state, see
+	// RenderSnapshot.h.  The state doesn't own the snapshots.
+	void addSnapshot(SnapshotBufferBase& snapshot) { snapshots_.push_back(&snapshot); }
+	void removeSnapshot(SnapshotBufferBase& snapshot) {
+		snapshots_.erase(std::remove(snapshots_.begin(), snapshots_.end(), &snapshot), snapshots_.end());
+	}
+
+	// For prepare(), both safe from the loader thread
+	void setLoadProgress(float progress) { load_progress_.store(progress, std::memory_order_relaxed); }
+	bool isLoadCancelled() const { return load_cancelled_.load(std::memory_order_relaxed); }
+
+	// A BACKGROUND state is updated every updateInterval ticks with the
+	// time since its last update, and rendered under the states covering
+	// it if renderCovered is set.  The default is RETAINED.
+	void setSuspendPolicy(SuspendMode mode, unsigned int updateInterval = 1, bool renderCovered = false) {
+		suspend_mode_ = mode;
+		background_interval_ = updateInterval > 0 ? updateInterval : 1;
+		render_covered_ = renderCovered;
+	}
+
+public:
+	EngineState() : load_phase_(UNLOADED), load_progress_(0.0f), load_cancelled_(false),
+		suspend_mode_(RETAINED), background_interval_(1), render_covered_(false), background_ticks_(0), background_time_(0.0),
+		free_slot_(~0u), system_count_(0), iterating_(0), next_sequence_(0),
+		update_unsorted_(false), render_unsorted_(false), update_holes_(false), render_holes_(false), update_dirty_(false), render_dirty_(false),
+		snapshot_pending_(false), render_pipelined_(false), job_system_(0), schedule_dirty_(true), schedule_valid_(false), cycle_reported_(false) {
+#ifndef MAXSYSTEMS
+#define MAXSYSTEMS 64
+#endif
+		slots_.reserve(MAXSYSTEMS);
+		slot_of_.reserve(MAXSYSTEMS);
+		update_keys_.reserve(MAXSYSTEMS);
+		render_keys_.reserve(MAXSYSTEMS);
+		update_order_.reserve(MAXSYSTEMS);
+		render_order_.reserve(MAXSYSTEMS);
+	}
+	virtual ~EngineState();
+
+	// Serial unless a job system was set, either way every update is
+	// finished when this returns
+	inline virtual void onUpdate(const double& deltaT) {
+		if (update_dirty_.load(std::memory_order_relaxed))
+			rebuildUpdateOrder();
+		++iterating_;
+		if (job_system_ && update_order_.size() > 1)
+			parallelUpdate(deltaT);
+		else
+			serialUpdate(deltaT);
+		endIteration();
+	}
+
+	// When the Engine renders on its own thread this runs alongside the
+	// next onUpdate, the systems' onRender may then only read what their
+	// onUpdate published to a snapshot, and must not add, remove, pause or
+	// hide systems.
+	inline virtual void onRender(const double& alpha) {
+		if (render_pipelined_) {
+			renderSystems(alpha);
+			return;
+		}
+		if (render_dirty_.load(std::memory_order_relaxed))
+			rebuildRenderOrder();
+		++iterating_;
+		renderSystems(alpha);
+		endIteration();
+	}
+
+	// The heavy part of starting a state, e.g. reading a level.  Called
+	// once before the state is first entered.  After Engine::loadState()
+	// it runs on a loader thread while the current state keeps ticking, so
+	// it may only touch the engine through createMessage(), which gives
+	// the loader thread a pool of its own, and postMessage().  Long loads
+	// should report setLoadProgress() and give up once isLoadCancelled().
+	virtual void prepare() {}
+	// Called on the tick() thread once prepare() has returned, ahead of the
+	// first enter().  Hooks up what prepare() built, keep it short.
+	virtual void activate() {}
+
+	// Undo prepare(), called on the tick() thread when the state is
+	// evicted.  After it the state is prepared and activated again before
+	// it is next entered.
+	virtual void releaseResources() {}
+
+	SuspendMode getSuspendMode() const { return suspend_mode_; }
+	unsigned int getBackgroundInterval() const { return background_interval_; }
+	bool rendersWhenCovered() const { return render_covered_; }
+
+	LoadPhase getLoadPhase() const { return static_cast<LoadPhase>(load_phase_.load(std::memory_order_acquire)); }
+	float getLoadProgress() const { return load_progress_.load(std::memory_order_relaxed); }
+
+	virtual void exit() = 0;
+	virtual void enter() = 0;
+};
+typedef std::shared_ptr<EngineState> EngineStatePtr;
+//-----------------------------------------------------------------------
+
+} // namespace engine
+
+#endif // _ENGINESTATE_
@@ -0,0 +1,73 @@
+/*=========================================================================
+/ James McCormick - FramePacer.cpp
+/ Holds Engine::tick() to a target rate
+/==========================================================================*/
+
+#include <chrono>
+#include <thread>
+#include "FramePacer.h"
+
+namespace engine {
+
+//========================================================================
+// FramePacer implemenation
+//========================================================================
+
+void FramePacer::setRate(double ticksPerSecond, double spinTime) {
+	period_ = ticksPerSecond > 0.0 ? (long long)(1e9 / ticksPerSecond) : 0;
+	spin_ = spinTime > 0.0 ? (long long)(spinTime * 1e9) : 0;
+	next_frame_ = 0;
+}
+
+
+//-----------------------------------------------------------------------
+// wait - Public FramePacer
+// Description
+//		Sleeps then spins until the current deadline and moves the
+//		deadline on a period.  Records the slack or the overrun of the
+//		frame that has just finished.  The first frame after a restart
+//		doesn't wait.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void FramePacer::wait() {
+	if (!period_)
+		return;
+
+	long long now = C_Timer::now();
+	if (!next_frame_) {
+		next_frame_ = now + period_;
+		return;
+	}
+
+	long long slack = next_frame_ - now;
+	++stats_.frames;
+	if (slack > 0) {
+		stats_.last_slack = slack;
+		stats_.last_overrun = 0;
+		stats_.slack_total += slack;
+
+		if (slack > spin_)
+			std::this_thread::sleep_for(std::chrono::nanoseconds(slack - spin_));
+		while ((now = C_Timer::now()) < next_frame_)
+			;
+
+		if (now - next_frame_ > stats_.wake_error_max)
+			stats_.wake_error_max = now - next_frame_;
+	}
+	else {
+		++stats_.overruns;
+		stats_.last_slack = 0;
+		stats_.last_overrun = -slack;
+		stats_.overrun_total -= slack;
+		if (-slack > stats_.overrun_max)
+			stats_.overrun_max = -slack;
+	}
+
+	next_frame_ += period_;
+	if (next_frame_ <= now)
+		next_frame_ = now + period_;
+}
+
+} // namespace engine
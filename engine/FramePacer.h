@@ -0,0 +1,71 @@
+/*=========================================================================
+/ James McCormick - FramePacer.h
+/ Holds Engine::tick() to a target rate
+/==========================================================================*/
+
+#ifndef _FRAMEPACER_
+#define _FRAMEPACER_
+
+#include "Timer.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// FramePacingStats
+// How the paced frames met their deadlines since the stats were last
+// reset.  Slack is the time left of a frame when its work was done,
+// overrun is how far past its deadline a frame's work ran.  Nanoseconds.
+struct FramePacingStats {
+	unsigned long frames;			// paced frames
+	unsigned long overruns;			// frames that missed their deadline
+	long long last_slack;
+	long long last_overrun;
+	long long slack_total;
+	long long overrun_total;
+	long long overrun_max;
+	long long wake_error_max;		// worst lateness of the wait itself, sleep overshoot plus spin
+
+	FramePacingStats() : frames(0), overruns(0), last_slack(0), last_overrun(0),
+		slack_total(0), overrun_total(0), overrun_max(0), wake_error_max(0) {}
+
+	double getAverageSlack() const { return frames > overruns ? slack_total * 1e-9 / (frames - overruns) : 0.0; }
+	double getAverageOverrun() const { return overruns ? overrun_total * 1e-9 / overruns : 0.0; }
+	double getOverrunRate() const { return frames ? (double)overruns / frames : 0.0; }
+};
+
+
+//-----------------------------------------------------------------------
+// FramePacer
+// Waits out the rest of each frame period.  The wait sleeps until
+// spin time before the deadline, then spins on the clock for the rest,
+// as a sleep can overshoot by far more than a frame can afford.  The
+// deadlines advance by exactly one period so the rate doesn't drift,
+// a frame more than a whole period late starts the schedule over
+// instead of rushing the missed frames out.
+class FramePacer {
+private:
+	long long period_;				// 0 when not pacing
+	long long spin_;
+	long long next_frame_;			// deadline of the frame waited for next, 0 before the first
+	FramePacingStats stats_;
+
+public:
+	FramePacer() : period_(0), spin_(0), next_frame_(0) {}
+
+	// 0 or less turns the pacing off
+	void setRate(double ticksPerSecond, double spinTime);
+	double getRate() const { return period_ ? 1e9 / period_ : 0.0; }
+	bool isPacing() const { return period_ != 0; }
+
+	// Blocks until the next frame is due
+	void wait();
+	// Drops the schedule, the next frame runs at once
+	void restart() { next_frame_ = 0; }
+
+	const FramePacingStats& getStats() const { return stats_; }
+	void resetStats() { stats_ = FramePacingStats(); }
+};
+
+} // namespace engine
+
+#endif // _FRAMEPACER_
@@ -0,0 +1,215 @@
+/*=========================================================================
+/ James McCormick - JobSystem.cpp
+/ A work-stealing thread pool
+/==========================================================================*/
+
+#include "JobSystem.h"
+
+namespace engine {
+
+namespace {
+	// Which pool and queue the current thread works for
+	thread_local const JobSystem* tls_job_system = 0;
+	thread_local std::size_t tls_worker_index = 0;
+}
+
+//========================================================================
+// JobSystem implemenation
+//========================================================================
+
+JobSystem::JobSystem() : running_(false), queued_jobs_(0) {
+	queues_.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+}
+
+
+//-----------------------------------------------------------------------
+// start - Public JobSystem
+// Description
+//		Spins up the worker threads.
+//
+// Arguments:	workerCount - number of threads, 0 to size from the hardware
+// Returns:		None.
+//-----------------------------------------------------------------------
+void JobSystem::start(unsigned int workerCount) {
+	if(running_)
+		return;
+
+	if(workerCount == 0) {
+		unsigned int hardware = std::thread::hardware_concurrency();
+		workerCount = hardware > 1 ? hardware - 1 : 1;
+	}
+
+	// Worker queues go in front of the shared queue, which may already hold jobs
+	std::unique_ptr<JobQueue> shared(std::move(queues_.back()));
+	queues_.clear();
+	for(unsigned int i = 0; i < workerCount; ++i)
+		queues_.push_back(std::unique_ptr<JobQueue>(new JobQueue()));
+	queues_.push_back(std::move(shared));
+
+	running_ = true;
+	for(unsigned int i = 0; i < workerCount; ++i)
+		threads_.push_back(std::thread(&JobSystem::workerLoop, this, i));
+}
+
+
+//-----------------------------------------------------------------------
+// stop - Public JobSystem
+// Description
+//		Joins the workers, anything still queued is run on the calling
+//		thread so no counter is left waiting.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void JobSystem::stop() {
+	if(running_) {
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			running_ = false;
+		}
+		wake_.notify_all();
+		for(auto& t : threads_)
+			t.join();
+		threads_.clear();
+	}
+
+	while(runPending())
+		;
+}
+
+
+//-----------------------------------------------------------------------
+// submit - Public JobSystem
+// Description
+//		Queues a job.  A worker pushes onto its own queue, any other thread
+//		onto the shared one.
+//
+// Arguments:	job - the work to do
+//				counter - optional counter to track completion with
+// Returns:		None.
+//-----------------------------------------------------------------------
+void JobSystem::submit(const Job& job, JobCounter* counter) {
+	if(counter)
+		counter->count_.fetch_add(1, std::memory_order_relaxed);
+
+	JobEntry entry = { job, counter };
+	JobQueue& queue = *queues_[getLocalQueue()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(entry));
+	}
+	queued_jobs_.fetch_add(1, std::memory_order_release);
+
+	// Taking the lock orders this against a worker deciding to sleep
+	if(running_.load(std::memory_order_relaxed)) {
+		{ std::lock_guard<std::mutex> lock(sleep_mutex_); }
+		wake_.notify_one();
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// wait - Public JobSystem
+// Description
+//		Helps run jobs until the counter reaches zero.
+//
+// Arguments:	counter - the counter to wait on
+// Returns:		None.
+//-----------------------------------------------------------------------
+void JobSystem::wait(JobCounter& counter) {
+	while(!counter.isDone()) {
+		if(!runPending())
+			std::this_thread::yield();
+	}
+}
+
+
+bool JobSystem::runPending() {
+	JobEntry entry;
+	if(!takeJob(getLocalQueue(), entry))
+		return false;
+
+	runJob(entry);
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+// workerLoop - Private JobSystem
+// Description
+//		Runs jobs until the pool is stopped, sleeping while there are none.
+//
+// Arguments:	index - the worker's own queue
+// Returns:		None.
+//-----------------------------------------------------------------------
+void JobSystem::workerLoop(std::size_t index) {
+	tls_job_system = this;
+	tls_worker_index = index;
+
+	while(running_.load(std::memory_order_relaxed)) {
+		JobEntry entry;
+		if(takeJob(index, entry)) {
+			runJob(entry);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		wake_.wait(lock, [this] {
+			return !running_.load(std::memory_order_relaxed) ||
+				queued_jobs_.load(std::memory_order_acquire) > 0;
+		});
+	}
+
+	tls_job_system = 0;
+}
+
+
+std::size_t JobSystem::getLocalQueue() const {
+	return tls_job_system == this ? tls_worker_index : queues_.size() - 1;
+}
+
+
+//-----------------------------------------------------------------------
+// takeJob - Private JobSystem
+// Description
+//		Pops the newest job off the home queue, otherwise steals the
+//		oldest job from another queue.
+//
+// Arguments:	home - the queue of the calling thread
+//				entry - receives the job
+// Returns:		true if a job was found
+//-----------------------------------------------------------------------
+bool JobSystem::takeJob(std::size_t home, JobEntry& entry) {
+	if(queued_jobs_.load(std::memory_order_acquire) <= 0)
+		return false;
+
+	const std::size_t count = queues_.size();
+	for(std::size_t i = 0; i < count; ++i) {
+		JobQueue& queue = *queues_[(home + i) % count];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if(queue.jobs.empty())
+			continue;
+
+		// Own queue LIFO for locality, shared queue and steals FIFO
+		if(i == 0 && home != count - 1) {
+			entry = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else {
+			entry = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		queued_jobs_.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+
+void JobSystem::runJob(JobEntry& entry) {
+	entry.job();
+	if(entry.counter)
+		entry.counter->count_.fetch_sub(1, std::memory_order_release);
+}
+
+}  // namespace engine
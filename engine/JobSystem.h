@@ -0,0 +1,122 @@
+/*=========================================================================
+/ James McCormick - JobSystem.h
+/ A work-stealing thread pool
+/==========================================================================*/
+
+#ifndef _JOBSYSTEM_
+#define _JOBSYSTEM_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// JobCounter
+// Counts the unfinished jobs submitted against it.  Jobs may submit more
+// jobs against the same counter, it only reaches zero once the whole tree
+// of jobs is done.
+class JobCounter {
+private:
+	friend class JobSystem;
+	std::atomic<int> count_;
+
+	JobCounter(const JobCounter&);
+	JobCounter& operator=(const JobCounter&);
+
+public:
+	JobCounter() : count_(0) {}
+	bool isDone() const { return count_.load(std::memory_order_acquire) == 0; }
+};
+
+typedef std::function<void ()> Job;
+
+
+//-----------------------------------------------------------------------
+// JobSystem
+// Every worker owns a deque, it pushes and pops its own jobs at the back
+// and steals from the front of the others when it runs dry.  Jobs
+// submitted from outside the pool go into an extra shared deque.  A
+// thread waiting on a counter runs jobs itself rather than blocking, so
+// waiting from inside a job cannot deadlock the pool.
+class JobSystem {
+private:
+	struct JobEntry {
+		Job job;
+		JobCounter* counter;
+	};
+
+	struct JobQueue {
+		std::mutex mutex;
+		std::deque<JobEntry> jobs;
+	};
+
+	// queues_[0 .. workers-1] belong to the workers, the last one is shared
+	std::vector<std::unique_ptr<JobQueue> > queues_;
+	std::vector<std::thread> threads_;
+
+	std::atomic<bool> running_;
+	std::atomic<int> queued_jobs_;
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+
+	JobSystem(const JobSystem&);
+	JobSystem& operator=(const JobSystem&);
+
+	void workerLoop(std::size_t index);
+	std::size_t getLocalQueue() const;
+	bool takeJob(std::size_t home, JobEntry& entry);
+	void runJob(JobEntry& entry);
+
+public:
+	JobSystem();
+	~JobSystem() { stop(); }
+
+	// Starts workerCount threads, 0 picks one less than the hardware thread count
+	void start(unsigned int workerCount = 0);
+	void stop();
+	bool isRunning() const { return running_.load(std::memory_order_relaxed); }
+	std::size_t getWorkerCount() const { return threads_.size(); }
+
+	// Safe from any thread, including from inside a job
+	void submit(const Job& job, JobCounter* counter = 0);
+
+	// Runs queued jobs on the calling thread until counter reaches zero
+	void wait(JobCounter& counter);
+
+	// Runs one queued job on the calling thread, false if there was none
+	bool runPending();
+
+	// Calls func(first, last) over [begin, end) in chunks of at most grain
+	// indices and returns once every chunk is done.  The calling thread
+	// takes its share of the chunks.
+	template <class Func>
+	void parallelFor(std::size_t begin, std::size_t end, std::size_t grain, const Func& func) {
+		if (begin >= end)
+			return;
+		if (grain == 0)
+			grain = 1;
+		if (end - begin <= grain) {
+			func(begin, end);
+			return;
+		}
+
+		JobCounter counter;
+		for (std::size_t first = begin + grain; first < end; first += grain) {
+			std::size_t last = end - first > grain ? first + grain : end;
+			submit([&func, first, last] { func(first, last); }, &counter);
+		}
+		func(begin, begin + grain);
+		wait(counter);
+	}
+};
+
+} // namespace engine
+
+#endif // _JOBSYSTEM_
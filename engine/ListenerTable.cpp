@@ -0,0 +1,227 @@
+/*=========================================================================
+/ James McCormick - ListenerTable.cpp
+/ Lookup from a message type to the listeners registered for it
+/==========================================================================*/
+
+#include <algorithm>
+#include "ListenerTable.h"
+
+namespace engine {
+
+//========================================================================
+// ListenerSet implemenation
+//========================================================================
+
+//-----------------------------------------------------------------------
+// add - Public ListenerSet
+// Description
+//		Adds a listener to the set.
+//
+// Arguments:	MsgListenerPtr - the listener to add
+//				id - the handle id to store with it, not 0
+//				filter - the types the listener wants, for wildcards
+// Returns:		the slot for the listener's handle, NOSLOT if it was
+//				already in the set
+//-----------------------------------------------------------------------
+unsigned int ListenerSet::add(const MsgListenerPtr& l, unsigned int id, const WildCardFilter& filter) {
+	unsigned int slot;
+	if(free_slots_.empty())
+		slot = (unsigned int)slots_.size();
+	else
+		slot = free_slots_.back();
+
+	if(!index_.insert(l.get(), slot))
+		return NOSLOT;
+
+	if(free_slots_.empty())
+		slots_.push_back(Slot());
+	else
+		free_slots_.pop_back();
+	slots_[slot].position = listeners_.size();
+	slots_[slot].id = id;
+
+	Entry entry = { l, filter, slot, false };
+	listeners_.push_back(entry);
+	return slot;
+}
+
+
+//-----------------------------------------------------------------------
+// remove - Public ListenerSet
+// Description
+//		Removes a listener by pointer.
+//
+// Arguments:	MsgListenerPtr - the listener to remove
+// Returns:		true if removed, false if it was not in the set
+//-----------------------------------------------------------------------
+bool ListenerSet::remove(const MsgListenerPtr& l) {
+	unsigned int slot;
+	if(!index_.find(l.get(), slot))
+		return false;
+
+	removeSlot(slot);
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+// remove - Public ListenerSet
+// Description
+//		Removes a listener through its handle.
+//
+// Arguments:	slot, id - from the listener's handle
+// Returns:		true if removed, false if the handle is stale
+//-----------------------------------------------------------------------
+bool ListenerSet::remove(unsigned int slot, unsigned int id) {
+	if(slot >= slots_.size() || slots_[slot].id != id || id == 0)
+		return false;
+
+	removeSlot(slot);
+	return true;
+}
+
+
+void ListenerSet::reserve(std::size_t count) {
+	listeners_.reserve(count);
+	slots_.reserve(count);
+	index_.reserve(count);
+}
+
+
+void ListenerSet::clear() {
+	listeners_.clear();
+	slots_.clear();
+	free_slots_.clear();
+	index_.clear();
+	typed_.reset();
+	batch_.clear();
+	removed_count_ = 0;
+	removed_batch_count_ = 0;
+}
+
+
+//-----------------------------------------------------------------------
+// removeSlot - Private ListenerSet
+// Description
+//		Frees the slot and takes the listener out of the dispatch list,
+//		or only marks it if a dispatch is running.
+//
+// Arguments:	slot - a slot in use
+// Returns:		None.
+//-----------------------------------------------------------------------
+void ListenerSet::removeSlot(unsigned int slot) {
+	std::size_t pos = slots_[slot].position;
+	index_.erase(listeners_[pos].listener.get());
+	slots_[slot].id = 0;
+	free_slots_.push_back(slot);
+
+	if(dispatch_depth_) {
+		listeners_[pos].removed = true;
+		++removed_count_;
+		return;
+	}
+
+	if(pos != listeners_.size() - 1) {
+		listeners_[pos] = listeners_.back();
+		slots_[listeners_[pos].slot].position = pos;
+	}
+	listeners_.pop_back();
+}
+
+
+//-----------------------------------------------------------------------
+// compact - Private ListenerSet
+// Description
+//		Drops the entries removed during the dispatch, keeping the order
+//		of the rest.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void ListenerSet::compact() {
+	if(removed_batch_count_) {
+		batch_.erase(std::remove(batch_.begin(), batch_.end(), BatchListenerPtr()), batch_.end());
+		removed_batch_count_ = 0;
+	}
+	if(!removed_count_)
+		return;
+
+	std::size_t kept = 0;
+	for(std::size_t i = 0; i < listeners_.size(); ++i) {
+		if(listeners_[i].removed)
+			continue;
+		if(kept != i)
+			listeners_[kept] = listeners_[i];
+		slots_[listeners_[kept].slot].position = kept;
+		++kept;
+	}
+	listeners_.resize(kept);
+	removed_count_ = 0;
+}
+
+
+//-----------------------------------------------------------------------
+// addBatch - Public ListenerSet
+// Description
+//		Adds a batch listener to the set.
+//
+// Arguments:	BatchListenerPtr - the listener to add
+// Returns:		true if added, false if it was already in the set
+//-----------------------------------------------------------------------
+bool ListenerSet::addBatch(const BatchListenerPtr& l) {
+	if(std::find(batch_.begin(), batch_.end(), l) != batch_.end())
+		return false;
+
+	batch_.push_back(l);
+	return true;
+}
+
+
+bool ListenerSet::removeBatch(const BatchListenerPtr& l) {
+	std::vector<BatchListenerPtr>::iterator itr = std::find(batch_.begin(), batch_.end(), l);
+	if(itr == batch_.end() || !l)
+		return false;
+
+	// A dispatch may be walking batch_, the entry goes at its end
+	if(dispatch_depth_) {
+		itr->reset();
+		++removed_batch_count_;
+		return true;
+	}
+	batch_.erase(itr);
+	return true;
+}
+
+
+
+//========================================================================
+// ListenerTable implemenation
+//========================================================================
+
+bool ListenerTable::setDenseLimit(std::size_t limit) {
+	if(!dense_.empty() || !sparse_.empty())
+		return false;
+
+	dense_limit_ = limit;
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+// get - Public ListenerTable
+// Description
+//		Finds the listener set for a type, creating it if needed.
+//
+// Arguments:	MessageType - the message type
+// Returns:		the listener set
+//-----------------------------------------------------------------------
+ListenerSet& ListenerTable::get(const MessageType& type) {
+	if(type < dense_limit_) {
+		if(type >= dense_.size())
+			dense_.resize(type + 1);
+		return dense_[type];
+	}
+	return sparse_[type];
+}
+
+}  // namespace engine
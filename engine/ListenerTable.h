@@ -0,0 +1,327 @@
+/*=========================================================================
+/ James McCormick - ListenerTable.h
+/ Lookup from a message type to the listeners registered for it
+/==========================================================================*/
+
+#ifndef _LISTENERTABLE_
+#define _LISTENERTABLE_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Message.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// TypedHandlerListBase
+// The handlers subscribed to a type through Engine::subscribe<T>(), see
+// TypedMessage.h.  Dispatch goes through a plain function pointer set by
+// the concrete list, so delivery needs no virtual call.
+class TypedHandlerListBase {
+public:
+	typedef bool (*DispatchFunc)(TypedHandlerListBase* self, const Message& msg);
+
+private:
+	DispatchFunc dispatch_;
+	const void* payload_tag_;		// unique per payload type, guards against mixing payloads on one id
+
+protected:
+	std::size_t handler_count_;
+
+public:
+	TypedHandlerListBase(DispatchFunc dispatch, const void* payloadTag)
+		: dispatch_(dispatch), payload_tag_(payloadTag), handler_count_(0) {}
+	virtual ~TypedHandlerListBase() {}
+
+	bool dispatch(const Message& msg) { return dispatch_(this, msg); }
+	bool empty() const { return handler_count_ == 0; }
+	std::size_t size() const { return handler_count_; }
+	const void* getPayloadTag() const { return payload_tag_; }
+};
+
+
+//-----------------------------------------------------------------------
+// ListenerHandle
+// Returned by Engine::addListener() and addWildCardListener(), removes
+// the listener in O(1) through Engine::removeListener().  A handle whose
+// listener is already gone is simply rejected.
+struct ListenerHandle {
+	MessageType type;
+	unsigned int slot;
+	unsigned int id;		// 0 when the listener was not added
+	bool wildcard;
+
+	ListenerHandle() : type(0), slot(0), id(0), wildcard(false) {}
+	ListenerHandle(const MessageType& t, unsigned int s, unsigned int i, bool w)
+		: type(t), slot(s), id(i), wildcard(w) {}
+
+	bool isValid() const { return id != 0; }
+	explicit operator bool() const { return id != 0; }
+};
+
+
+//-----------------------------------------------------------------------
+// WildCardFilter
+// The message types a wildcard listener wants, checked before the
+// listener is called.  A type passes when it is inside [first, last] and
+// its bits under mask equal value, the default passes everything.
+struct WildCardFilter {
+	MessageType first;
+	MessageType last;
+	MessageType mask;
+	MessageType value;
+
+	WildCardFilter() : first(0), last(~MessageType(0)), mask(0), value(0) {}
+	WildCardFilter(const MessageType& f, const MessageType& l, const MessageType& m, const MessageType& v)
+		: first(f), last(l), mask(m), value(v & m) {}
+
+	static WildCardFilter range(const MessageType& first, const MessageType& last) {
+		return WildCardFilter(first, last, 0, 0);
+	}
+	// e.g. a category kept in the high bits of the type id
+	static WildCardFilter bits(const MessageType& mask, const MessageType& value) {
+		return WildCardFilter(0, ~MessageType(0), mask, value);
+	}
+
+	bool matches(const MessageType& type) const {
+		return type - first <= last - first && (type & mask) == value;
+	}
+};
+
+
+//-----------------------------------------------------------------------
+// ListenerIndex
+// Listener pointer to slot, open addressed with linear probing in one
+// flat array.  Nothing is allocated per entry, so clearing or destroying
+// the index is a single free however many listeners it holds.  Erasing
+// shifts the entries behind back into the gap instead of leaving
+// tombstones.
+class ListenerIndex {
+private:
+	struct Bucket {
+		MessageListener* key;		// 0 for an empty bucket
+		unsigned int slot;
+	};
+	std::vector<Bucket> buckets_;	// a power of two in size, at most half full
+	std::size_t size_;
+	unsigned int shift_;			// 64 less the bits of the bucket count
+
+	std::size_t home(const MessageListener* key) const {
+		return (std::size_t)(((std::uint64_t)(std::uintptr_t)key * 0x9E3779B97F4A7C15ull) >> shift_);
+	}
+
+	// Where key is, or the empty bucket it would go in
+	std::size_t probe(const MessageListener* key) const {
+		const std::size_t mask = buckets_.size() - 1;
+		std::size_t i = home(key);
+		while (buckets_[i].key && buckets_[i].key != key)
+			i = (i + 1) & mask;
+		return i;
+	}
+
+	void rehash(std::size_t bucketCount) {
+		std::vector<Bucket> old(bucketCount, Bucket());
+		old.swap(buckets_);
+		shift_ = 64;
+		for (std::size_t n = bucketCount; n > 1; n >>= 1)
+			--shift_;
+		for (auto& bucket : old)
+			if (bucket.key)
+				buckets_[probe(bucket.key)] = bucket;
+	}
+
+public:
+	ListenerIndex() : size_(0), shift_(64) {}
+
+	std::size_t size() const { return size_; }
+
+	// Room for count entries without growing
+	void reserve(std::size_t count) {
+		std::size_t buckets = 8;
+		while (buckets < count * 2)
+			buckets <<= 1;
+		if (buckets > buckets_.size())
+			rehash(buckets);
+	}
+
+	// false if key is already in the index
+	bool insert(MessageListener* key, unsigned int slot) {
+		if ((size_ + 1) * 2 > buckets_.size())
+			rehash(buckets_.empty() ? 8 : buckets_.size() * 2);
+		std::size_t i = probe(key);
+		if (buckets_[i].key)
+			return false;
+		buckets_[i].key = key;
+		buckets_[i].slot = slot;
+		++size_;
+		return true;
+	}
+
+	bool find(const MessageListener* key, unsigned int& slot) const {
+		if (size_ == 0)
+			return false;
+		std::size_t i = probe(key);
+		if (!buckets_[i].key)
+			return false;
+		slot = buckets_[i].slot;
+		return true;
+	}
+
+	bool erase(const MessageListener* key) {
+		if (size_ == 0)
+			return false;
+		const std::size_t mask = buckets_.size() - 1;
+		std::size_t gap = probe(key);
+		if (!buckets_[gap].key)
+			return false;
+
+		// Pull back every entry that probed past the gap
+		for (std::size_t i = (gap + 1) & mask; buckets_[i].key; i = (i + 1) & mask) {
+			if (((i - home(buckets_[i].key)) & mask) >= ((i - gap) & mask)) {
+				buckets_[gap] = buckets_[i];
+				gap = i;
+			}
+		}
+		buckets_[gap].key = 0;
+		--size_;
+		return true;
+	}
+
+	// Frees the array
+	void clear() {
+		std::vector<Bucket>().swap(buckets_);
+		size_ = 0;
+		shift_ = 64;
+	}
+};
+
+
+//-----------------------------------------------------------------------
+// ListenerSet
+// The listeners for one message type, kept contiguous for dispatch.
+// The order of the listeners is not considered, removal swaps the last
+// listener into the hole.  While a dispatch is running through the set
+// removals only mark the listener, which keeps its reference until the
+// outermost dispatch ends and compacts the set.  Batch listeners removed
+// during a dispatch are left as NULL entries until the same compaction.
+class ListenerSet {
+public:
+	static const unsigned int NOSLOT = ~0u;
+
+private:
+	struct Entry {
+		MsgListenerPtr listener;
+		WildCardFilter filter;		// only used by the wildcard set
+		unsigned int slot;
+		bool removed;
+	};
+	struct Slot {
+		std::size_t position;		// where the listener sits in listeners_
+		unsigned int id;			// 0 while the slot is free
+	};
+
+	std::vector<Entry> listeners_;
+	std::vector<Slot> slots_;					// stable positions for the handles
+	std::vector<unsigned int> free_slots_;
+	ListenerIndex index_;						// for O(1) duplicate checks and removal by pointer
+	std::unique_ptr<TypedHandlerListBase> typed_;
+	std::vector<BatchListenerPtr> batch_;		// few per type, kept in registration order
+	unsigned int dispatch_depth_;
+	std::size_t removed_count_;					// marked entries waiting for the compaction
+	std::size_t removed_batch_count_;			// NULL batch_ entries, the same
+
+	void removeSlot(unsigned int slot);
+	void compact();
+
+public:
+	ListenerSet() : dispatch_depth_(0), removed_count_(0), removed_batch_count_(0) {}
+
+	// Returns the listener's slot, NOSLOT if it was already in the set
+	unsigned int add(const MsgListenerPtr& l, unsigned int id, const WildCardFilter& filter = WildCardFilter());
+	bool remove(const MsgListenerPtr& l);
+	bool remove(unsigned int slot, unsigned int id);
+	bool contains(const MsgListenerPtr& l) const {
+		unsigned int slot;
+		return index_.find(l.get(), slot);
+	}
+	// Room for count MessageListeners in all
+	void reserve(std::size_t count);
+	void clear();
+
+	// True when there are no MessageListeners, typed handlers or batch listeners
+	bool empty() const {
+		return listeners_.size() == removed_count_ && batch_.size() == removed_batch_count_ && (!typed_ || typed_->empty());
+	}
+
+	// Dispatch loops run to size() and skip the NULL entries of removed listeners
+	std::size_t size() const { return listeners_.size(); }
+	MessageListener* operator[](std::size_t i) const {
+		return listeners_[i].removed ? 0 : listeners_[i].listener.get();
+	}
+	// Same, and NULL as well when the entry's filter rejects type
+	MessageListener* get(std::size_t i, const MessageType& type) const {
+		const Entry& entry = listeners_[i];
+		return entry.removed || !entry.filter.matches(type) ? 0 : entry.listener.get();
+	}
+
+	// Bracket every loop over the listeners, the calls nest
+	void beginDispatch() { ++dispatch_depth_; }
+	void endDispatch() {
+		if (--dispatch_depth_ == 0 && (removed_count_ || removed_batch_count_))
+			compact();
+	}
+
+	bool addBatch(const BatchListenerPtr& l);
+	bool removeBatch(const BatchListenerPtr& l);
+	// NULL for a batch listener removed during the dispatch
+	std::size_t batchSize() const { return batch_.size(); }
+	const BatchListenerPtr& getBatch(std::size_t i) const { return batch_[i]; }
+
+	TypedHandlerListBase* getTyped() const { return typed_.get(); }
+	void setTyped(TypedHandlerListBase* typed) { typed_.reset(typed); }
+};
+
+
+//-----------------------------------------------------------------------
+// ListenerTable
+// Message types below the dense limit index straight into an array,
+// anything above it falls back to a hash map.  Sets are never moved once
+// created, so a set stays valid while its listeners register new types.
+class ListenerTable {
+private:
+	static const std::size_t DEFAULTDENSELIMIT = 256;
+
+	std::size_t dense_limit_;
+	std::deque<ListenerSet> dense_;
+	std::unordered_map<MessageType, ListenerSet> sparse_;
+
+public:
+	ListenerTable() : dense_limit_(DEFAULTDENSELIMIT) {}
+
+	// Types below limit use the dense array, 0 sends everything to the hash map.
+	// Only allowed while the table is empty.
+	bool setDenseLimit(std::size_t limit);
+	std::size_t getDenseLimit() const { return dense_limit_; }
+
+	// The set for type, or NULL if nothing was ever registered for it
+	ListenerSet* find(const MessageType& type) {
+		if(type < dense_limit_)
+			return type < dense_.size() ? &dense_[type] : 0;
+		std::unordered_map<MessageType, ListenerSet>::iterator itr = sparse_.find(type);
+		return itr == sparse_.end() ? 0 : &itr->second;
+	}
+
+	// The set for type, created if needed
+	ListenerSet& get(const MessageType& type);
+
+	void clear() { dense_.clear(); sparse_.clear(); }
+};
+//-----------------------------------------------------------------------
+
+} // namespace engine
+
+#endif // _LISTENERTABLE_
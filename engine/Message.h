@@ -0,0 +1,138 @@
+/*=========================================================================
+/ James McCormick - Message.h
+/ The messages and listeners passed around by the Engine
+/==========================================================================*/
+
+#ifndef _MESSAGE_
+#define _MESSAGE_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace engine {
+
+class MessagePool;
+
+//-----------------------------------------------------------------------
+// The messaging interface
+typedef unsigned int MessageType;
+class Message {
+private:
+	friend class Engine;
+	friend class MessageInbox;
+	friend class MessagePool;
+
+	Message();
+	const double time_stamp_;
+	const MessageType message_type_;
+
+	// Pool bookkeeping, filled in by MessagePool::create()
+	mutable unsigned int ref_count_;	// The queue plus any MessageRefs holding the message
+	MessagePool* pool_;					// NULL when the message is not pool allocated
+	unsigned short block_offset_;		// Offset of this base from the start of the pool block
+	unsigned char size_class_;
+	unsigned char superseded_;			// coalesced into a newer message, dropped at the next dispatch
+
+	unsigned int requeue_count_;		// times the Engine put the message back unconsumed
+	Message* next_;						// intrusive link while the message sits in a MessageInbox
+
+public:
+	Message(const MessageType& type, const double& stamp)
+		: time_stamp_(stamp), message_type_(type),
+		  ref_count_(0), pool_(0), block_offset_(0), size_class_(0), superseded_(0), requeue_count_(0), next_(0) {}
+	virtual ~Message() {}
+
+	const double& getTimeStamp() const { return time_stamp_; }
+	const MessageType& getType() const { return message_type_; }
+
+	bool isPooled() const { return pool_ != 0; }
+	unsigned int getRequeueCount() const { return requeue_count_; }
+};
+
+
+// Listeners are handed a non-owning reference that is only valid for the
+// duration of the call.  Use a MessageRef to keep a message past the tick.
+class MessageListener {
+public:
+	virtual ~MessageListener() {}
+	virtual bool onMessage(const Message& msg) = 0;
+};
+typedef std::shared_ptr<MessageListener> MsgListenerPtr;
+
+
+// A run of queued messages of one type, oldest first.  The listener marks
+// what it consumed, a message is consumed if any listener consumed it.
+// Only valid for the duration of the onMessages() call.
+class MessageBatch {
+private:
+	const Message* const* messages_;
+	unsigned char* consumed_;		// one flag per message, shared by every batch listener
+	std::size_t count_;
+
+public:
+	MessageBatch(const Message* const* messages, unsigned char* consumed, std::size_t count)
+		: messages_(messages), consumed_(consumed), count_(count) {}
+
+	std::size_t size() const { return count_; }
+	bool empty() const { return count_ == 0; }
+	const Message& operator[](std::size_t i) const { return *messages_[i]; }
+	const Message* const* data() const { return messages_; }
+
+	void consume(std::size_t i) { consumed_[i] = 1; }
+	void consumeAll() { for (std::size_t i = 0; i < count_; ++i) consumed_[i] = 1; }
+	bool isConsumed(std::size_t i) const { return consumed_[i] != 0; }
+};
+
+
+// Gets every pending message of its type in one call per dispatch instead
+// of one onMessage() per message.  Messages sent with triggerMessage()
+// arrive as a batch of one.
+class BatchMessageListener {
+public:
+	virtual ~BatchMessageListener() {}
+	virtual void onMessages(MessageBatch& batch) = 0;
+};
+typedef std::shared_ptr<BatchMessageListener> BatchListenerPtr;
+
+
+// How long the Engine keeps requeueing a message nobody consumes.
+// The policy is checked each time a queued message comes back unconsumed.
+struct MessagePolicy {
+	static const unsigned int UNLIMITED = ~0u;
+
+	unsigned int max_requeues;		// UNLIMITED to never drop on count
+	double time_to_live;			// seconds past the time stamp, 0 to never expire
+
+	MessagePolicy() : max_requeues(UNLIMITED), time_to_live(0.0) {}
+	MessagePolicy(unsigned int maxRequeues, double ttl) : max_requeues(maxRequeues), time_to_live(ttl) {}
+};
+
+// Why an unconsumed message was dropped
+enum MessageDropReason {
+	REQUEUE_LIMIT,
+	EXPIRED
+};
+
+// Called with each message dropped by its MessagePolicy, before it is released
+typedef std::function<void (const Message&, MessageDropReason)> DeadLetterHandler;
+
+// Latest value wins for a message type.  A queued message with the same
+// key as one still waiting for the next dispatch takes its place, the
+// older one is dropped without being delivered.  merge, if set, can fold
+// the older message into the newer first.
+struct CoalescePolicy {
+	typedef std::function<unsigned long long (const Message&)> Key;
+	typedef std::function<void (const Message& older, Message& newer)> Merge;
+
+	Key key;			// empty for one message per type
+	Merge merge;		// empty to keep the newer as it is
+
+	CoalescePolicy() {}
+	CoalescePolicy(const Key& k, const Merge& m = Merge()) : key(k), merge(m) {}
+};
+//-----------------------------------------------------------------------
+
+} // namespace engine
+
+#endif // _MESSAGE_
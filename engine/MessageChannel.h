@@ -0,0 +1,181 @@
+/*=========================================================================
+/ James McCormick - MessageChannel.h
+/ Lock-free single producer, single consumer link between two Engines
+/==========================================================================*/
+
+#ifndef _MESSAGECHANNEL_
+#define _MESSAGECHANNEL_
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include "Message.h"
+#include "MessagePool.h"
+#include "RingBuffer.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// MessageChannelStats
+// A snapshot of a channel's counters, readable from either side.
+struct MessageChannelStats {
+	unsigned long sent;					// taken by send()
+	unsigned long received;				// handed to the consumer
+	unsigned long dropped;				// refused by send() past the pending limit
+	unsigned long stalled_flushes;		// flushes that found the ring full and kept messages back
+	std::size_t pending;				// left waiting for room in the ring by the last flush
+	std::size_t max_pending;
+	std::size_t in_flight;				// in the ring, published but not yet received
+};
+
+
+//-----------------------------------------------------------------------
+// MessageChannel
+// Carries messages from the thread of one Engine into the queue of
+// another without either side locking.  The producer collects what it
+// sends during a tick and publishes the whole batch into a fixed size
+// ring with one store at flush(), the consumer takes everything published
+// with one load when it drains.  Messages move by pointer and the channel
+// holds the sender's reference in between, so nothing is copied.
+//
+// When the consumer falls behind and the ring fills, flush() keeps the
+// rest back in order for the next flush, past the pending limit send()
+// refuses new messages.  The stats show how often either happens.
+//
+// The messages come from the sending engine's pool, released on the
+// receiving side they go back to it through the pool's return list.
+// The sending engine has to outlive the messages in the channel.
+class MessageChannel {
+private:
+	static const std::size_t CACHELINE = 64;
+
+	std::vector<Message*> ring_;
+	const std::size_t mask_;
+
+	// Producer side
+	alignas(CACHELINE) std::atomic<std::size_t> tail_;		// next slot to publish
+	std::size_t head_cache_;								// the consumer's head as last seen
+	RingBuffer<Message*> pending_;
+	const std::size_t max_pending_;
+	std::atomic<unsigned long> sent_;
+	std::atomic<unsigned long> dropped_;
+	std::atomic<unsigned long> stalled_flushes_;
+	std::atomic<std::size_t> pending_count_;
+	std::atomic<std::size_t> pending_max_;
+
+	// Consumer side
+	alignas(CACHELINE) std::atomic<std::size_t> head_;		// next slot to receive
+	std::size_t tail_cache_;
+	std::atomic<unsigned long> received_;
+
+	MessageChannel(const MessageChannel&);
+	MessageChannel& operator=(const MessageChannel&);
+
+	static std::size_t roundUp(std::size_t capacity) {
+		std::size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		return size;
+	}
+
+public:
+	// capacity is rounded up to a power of two.  maxPending 0 never refuses.
+	explicit MessageChannel(std::size_t capacity = 4096, std::size_t maxPending = 0)
+		: ring_(roundUp(capacity)), mask_(ring_.size() - 1),
+		  tail_(0), head_cache_(0), max_pending_(maxPending), sent_(0), dropped_(0), stalled_flushes_(0),
+		  pending_count_(0), pending_max_(0), head_(0), tail_cache_(0), received_(0) {}
+
+	// Once neither side is running
+	~MessageChannel() {
+		std::size_t head = head_.load(std::memory_order_relaxed);
+		std::size_t tail = tail_.load(std::memory_order_relaxed);
+		for (; head != tail; ++head)
+			MessagePool::release(ring_[head & mask_]);
+		for (std::size_t i = 0; i < pending_.size(); ++i)
+			MessagePool::release(pending_[i]);
+	}
+
+	// Producer thread.  Takes over the caller's reference, even when the
+	// message is refused.  Nothing reaches the consumer before flush().
+	bool send(Message* msg) {
+		if (max_pending_ && pending_.size() >= max_pending_) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			MessagePool::release(msg);
+			return false;
+		}
+		pending_.push_back(msg);
+		sent_.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Producer thread.  Publishes as much of the pending batch as the ring
+	// has room for, returns how many messages went.
+	std::size_t flush() {
+		std::size_t count = pending_.size();
+		if (count == 0)
+			return 0;
+
+		std::size_t tail = tail_.load(std::memory_order_relaxed);
+		std::size_t room = ring_.size() - (tail - head_cache_);
+		if (room < count) {
+			head_cache_ = head_.load(std::memory_order_acquire);
+			room = ring_.size() - (tail - head_cache_);
+		}
+
+		std::size_t publish = count < room ? count : room;
+		for (std::size_t i = 0; i < publish; ++i)
+			ring_[(tail + i) & mask_] = pending_[i];
+		tail_.store(tail + publish, std::memory_order_release);
+		pending_.pop_front(publish);
+		if (pending_.empty())
+			pending_.clear();
+
+		std::size_t left = pending_.size();
+		if (left) {
+			stalled_flushes_.fetch_add(1, std::memory_order_relaxed);
+			if (left > pending_max_.load(std::memory_order_relaxed))
+				pending_max_.store(left, std::memory_order_relaxed);
+		}
+		pending_count_.store(left, std::memory_order_relaxed);
+		return publish;
+	}
+
+	// Consumer thread.  Hands func every published message oldest first,
+	// func takes over the channel's reference.  Returns the count.
+	template <class Func>
+	std::size_t receive(Func func) {
+		std::size_t head = head_.load(std::memory_order_relaxed);
+		if (head == tail_cache_) {
+			tail_cache_ = tail_.load(std::memory_order_acquire);
+			if (head == tail_cache_)
+				return 0;
+		}
+
+		std::size_t count = tail_cache_ - head;
+		for (std::size_t i = 0; i < count; ++i)
+			func(ring_[(head + i) & mask_]);
+		head_.store(head + count, std::memory_order_release);
+		received_.fetch_add(count, std::memory_order_relaxed);
+		return count;
+	}
+
+	std::size_t capacity() const { return ring_.size(); }
+
+	// Any thread, the counters are each exact but not taken together
+	MessageChannelStats getStats() const {
+		MessageChannelStats stats;
+		stats.sent = sent_.load(std::memory_order_relaxed);
+		stats.received = received_.load(std::memory_order_relaxed);
+		stats.dropped = dropped_.load(std::memory_order_relaxed);
+		stats.stalled_flushes = stalled_flushes_.load(std::memory_order_relaxed);
+		stats.pending = pending_count_.load(std::memory_order_relaxed);
+		stats.max_pending = pending_max_.load(std::memory_order_relaxed);
+		std::size_t head = head_.load(std::memory_order_relaxed);
+		stats.in_flight = tail_.load(std::memory_order_relaxed) - head;
+		return stats;
+	}
+};
+
+} // namespace engine
+
+#endif // _MESSAGECHANNEL_
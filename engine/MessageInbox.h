@@ -0,0 +1,80 @@
+/*=========================================================================
+/ James McCormick - MessageInbox.h
+/ Lock-free multi-producer, single consumer hand off of messages
+/==========================================================================*/
+
+#ifndef _MESSAGEINBOX_
+#define _MESSAGEINBOX_
+
+#include <atomic>
+#include <cstddef>
+#include "Message.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// MessageInbox
+// Producers push onto an intrusive stack with a single compare and swap,
+// a whole block of messages is linked privately first and pushed as one
+// chain.  The consumer takes the entire stack with one exchange and
+// reverses it back into posting order, so draining is O(messages) and
+// never blocks or locks.
+class MessageInbox {
+private:
+	std::atomic<Message*> head_;
+
+	MessageInbox(const MessageInbox&);
+	MessageInbox& operator=(const MessageInbox&);
+
+	void pushChain(Message* first, Message* last) {
+		Message* head = head_.load(std::memory_order_relaxed);
+		do {
+			last->next_ = head;
+		} while (!head_.compare_exchange_weak(head, first,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+public:
+	MessageInbox() : head_(0) {}
+
+	// Any thread
+	void post(Message* msg) { pushChain(msg, msg); }
+
+	// Any thread, the block keeps its order relative to itself
+	void post(Message* const* msgs, std::size_t count) {
+		if (count == 0)
+			return;
+
+		// Link newest to oldest, the same order single posts end up in
+		for (std::size_t i = count - 1; i > 0; --i)
+			msgs[i]->next_ = msgs[i - 1];
+		pushChain(msgs[count - 1], msgs[0]);
+	}
+
+	bool empty() const { return head_.load(std::memory_order_relaxed) == 0; }
+
+	// Consumer thread only, hands func every posted message oldest first
+	template <class Func>
+	void drain(Func func) {
+		Message* msg = head_.exchange(0, std::memory_order_acquire);
+
+		Message* ordered = 0;
+		while (msg) {
+			Message* next = msg->next_;
+			msg->next_ = ordered;
+			ordered = msg;
+			msg = next;
+		}
+
+		while (ordered) {
+			Message* next = ordered->next_;
+			ordered->next_ = 0;
+			func(ordered);
+			ordered = next;
+		}
+	}
+};
+
+} // namespace engine
+
+#endif // _MESSAGEINBOX_
@@ -0,0 +1,146 @@
+/*=========================================================================
+/ James McCormick - MessagePool.cpp
+/ Slab storage for the messages that move through the Engine queues
+/==========================================================================*/
+
+#include "MessagePool.h"
+
+namespace engine {
+
+//========================================================================
+// MessagePool implemenation
+//========================================================================
+
+MessagePool::MessagePool() : live_count_(0), owner_(std::this_thread::get_id()), remote_free_(0) {
+	for(std::size_t i = 0; i < SIZECLASSES; ++i)
+		free_list_[i] = 0;
+}
+
+
+MessagePool::~MessagePool() {
+	collectRemote();
+	for(auto slab : slabs_)
+		::operator delete(slab);
+}
+
+
+//-----------------------------------------------------------------------
+// allocate - Private MessagePool
+// Description
+//		Grabs a block big enough for size bytes.
+//
+// Arguments:	size - the size of the message
+//				sizeClass - set to the size class the block came from
+// Returns:		the raw block
+//-----------------------------------------------------------------------
+void* MessagePool::allocate(std::size_t size, unsigned char& sizeClass) {
+	std::size_t c = (size + GRANULARITY - 1) / GRANULARITY - 1;
+	if(c >= SIZECLASSES) {
+		sizeClass = LARGECLASS;
+		return ::operator new(size);
+	}
+
+	if(!free_list_[c]) {
+		collectRemote();
+		if(!free_list_[c])
+			refill(c);
+	}
+
+	FreeBlock* block = free_list_[c];
+	free_list_[c] = block->next;
+	sizeClass = static_cast<unsigned char>(c);
+	return block;
+}
+
+
+//-----------------------------------------------------------------------
+// deallocate - Private MessagePool
+// Description
+//		Returns a block to the free list of its size class.
+//
+// Arguments:	block - the raw block
+//				sizeClass - the size class the block came from
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessagePool::deallocate(void* block, unsigned char sizeClass) {
+	if(sizeClass == LARGECLASS) {
+		::operator delete(block);
+		return;
+	}
+
+	FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+	freeBlock->next = free_list_[sizeClass];
+	free_list_[sizeClass] = freeBlock;
+}
+
+
+//-----------------------------------------------------------------------
+// refill - Private MessagePool
+// Description
+//		Carves a new slab into blocks for an empty size class.
+//
+// Arguments:	sizeClass - the size class to refill
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessagePool::refill(std::size_t sizeClass) {
+	const std::size_t blockSize = (sizeClass + 1) * GRANULARITY;
+	char* slab = static_cast<char*>(::operator new(blockSize * BLOCKSPERSLAB));
+	slabs_.push_back(slab);
+
+	for(std::size_t i = BLOCKSPERSLAB; i > 0; --i) {
+		FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + (i - 1) * blockSize);
+		block->next = free_list_[sizeClass];
+		free_list_[sizeClass] = block;
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// collectRemote - Private MessagePool
+// Description
+//		Moves the blocks released by other threads onto the free lists.
+//		Owner thread only.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessagePool::collectRemote() {
+	FreeBlock* block = remote_free_.exchange(0, std::memory_order_acquire);
+	while(block) {
+		FreeBlock* next = block->next;
+		deallocate(block, block->size_class);
+		--live_count_;
+		block = next;
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// destroy - Private MessagePool
+// Description
+//		Runs the message destructor and recycles its block.
+//
+// Arguments:	msg - the message whose last reference was released
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessagePool::destroy(const Message* msg) {
+	void* block = const_cast<char*>(reinterpret_cast<const char*>(msg)) - msg->block_offset_;
+	unsigned char sizeClass = msg->size_class_;
+
+	msg->~Message();
+	if(isOwnerThread()) {
+		deallocate(block, sizeClass);
+		--live_count_;
+		return;
+	}
+
+	// Released on another thread, hand the block back to the owner
+	FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+	freeBlock->size_class = sizeClass;
+	freeBlock->next = remote_free_.load(std::memory_order_relaxed);
+	while(!remote_free_.compare_exchange_weak(freeBlock->next, freeBlock,
+		std::memory_order_release, std::memory_order_relaxed))
+		;
+}
+
+}  // namespace engine
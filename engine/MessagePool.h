@@ -0,0 +1,153 @@
+/*=========================================================================
+/ James McCormick - MessagePool.h
+/ Slab storage for the messages that move through the Engine queues
+/==========================================================================*/
+
+#ifndef _MESSAGEPOOL_
+#define _MESSAGEPOOL_
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Message.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// MessagePool
+// Messages are bucketed by size into 16 byte size classes, each with its
+// own free list carved out of larger slabs.  A message goes back on its
+// free list as soon as the last owner releases it, so a steady stream of
+// messages recycles the same blocks every dispatch pass.  Messages larger
+// than the biggest size class go to the global heap.
+// The pool has to outlive every message created from it.
+//
+// create() may only be called by the pool's owner, the thread that
+// constructed it or last called bindToCurrentThread().  Messages can be
+// released on any thread, a block freed off the owner thread goes onto a
+// lock-free return list that the owner folds back into its free lists
+// the next time it runs dry.
+class MessagePool {
+private:
+	static const std::size_t GRANULARITY = 16;
+	static const std::size_t SIZECLASSES = 16;		// 16 to 256 byte blocks
+	static const std::size_t BLOCKSPERSLAB = 64;
+	static const unsigned char LARGECLASS = 0xFF;
+
+	struct FreeBlock {
+		FreeBlock* next;
+		unsigned char size_class;		// only used on the remote list
+	};
+
+	FreeBlock* free_list_[SIZECLASSES];
+	std::vector<void*> slabs_;
+	std::size_t live_count_;
+
+	std::atomic<std::thread::id> owner_;
+	std::atomic<FreeBlock*> remote_free_;	// blocks released by other threads
+
+	MessagePool(const MessagePool&);
+	MessagePool& operator=(const MessagePool&);
+
+	void* allocate(std::size_t size, unsigned char& sizeClass);
+	void deallocate(void* block, unsigned char sizeClass);
+	void refill(std::size_t sizeClass);
+	void collectRemote();
+	void destroy(const Message* msg);
+
+public:
+	MessagePool();
+	~MessagePool();
+
+	// Hands the pool to the calling thread, e.g. when an Engine built on
+	// one thread is started on another.  Only while the old owner has
+	// stopped creating from it.
+	void bindToCurrentThread() { owner_.store(std::this_thread::get_id(), std::memory_order_release); }
+	bool isOwnerThread() const { return owner_.load(std::memory_order_relaxed) == std::this_thread::get_id(); }
+
+	// Construct a message in the pool.  The caller holds the only reference
+	// and hands it off with Engine::queueMessage() or drops it with release().
+	template <class T, class... Args>
+	T* create(Args&&... args) {
+		static_assert(std::is_base_of<Message, T>::value, "T must derive from engine::Message");
+		static_assert(std::alignment_of<T>::value <= GRANULARITY, "T is over aligned for the pool");
+
+		unsigned char sizeClass;
+		void* block = allocate(sizeof(T), sizeClass);
+		T* msg;
+		try {
+			msg = new (block) T(std::forward<Args>(args)...);
+		}
+		catch(...) {
+			deallocate(block, sizeClass);
+			throw;
+		}
+
+		Message* base = msg;
+		base->pool_ = this;
+		base->size_class_ = sizeClass;
+		base->block_offset_ = static_cast<unsigned short>(
+			reinterpret_cast<char*>(base) - static_cast<char*>(block));
+		base->ref_count_ = 1;
+		++live_count_;
+		return msg;
+	}
+
+	static void retain(const Message& msg) { ++msg.ref_count_; }
+
+	// Drops a reference, the message is destroyed when the last one goes.
+	// Messages that did not come from a pool are never deleted here.
+	static void release(const Message* msg) {
+		if(msg->ref_count_ > 0 && --msg->ref_count_ == 0 && msg->pool_)
+			msg->pool_->destroy(msg);
+	}
+
+	// Number of messages created from the pool that have not been released
+	std::size_t getLiveCount() const { return live_count_; }
+};
+
+
+//-----------------------------------------------------------------------
+// MessageRef
+// The opt-in way to keep a message alive after the listener call it was
+// delivered in.  Only pooled messages have their lifetime extended.
+class MessageRef {
+private:
+	const Message* msg_;
+
+public:
+	MessageRef() : msg_(0) {}
+	explicit MessageRef(const Message& msg) : msg_(&msg) { MessagePool::retain(msg); }
+	MessageRef(const MessageRef& other) : msg_(other.msg_) {
+		if(msg_)
+			MessagePool::retain(*msg_);
+	}
+	MessageRef(MessageRef&& other) : msg_(other.msg_) { other.msg_ = 0; }
+	~MessageRef() { reset(); }
+
+	MessageRef& operator=(MessageRef other) {
+		std::swap(msg_, other.msg_);
+		return *this;
+	}
+
+	void reset() {
+		if(msg_) {
+			MessagePool::release(msg_);
+			msg_ = 0;
+		}
+	}
+
+	const Message* get() const { return msg_; }
+	const Message& operator*() const { return *msg_; }
+	const Message* operator->() const { return msg_; }
+	explicit operator bool() const { return msg_ != 0; }
+};
+//-----------------------------------------------------------------------
+
+} // namespace engine
+
+#endif // _MESSAGEPOOL_
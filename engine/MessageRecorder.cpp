@@ -0,0 +1,393 @@
+/*=========================================================================
+/ James McCormick - MessageRecorder.cpp
+/ Recording the Engine's message stream and playing it back
+/==========================================================================*/
+
+#include "MessageRecorder.h"
+
+namespace engine {
+
+// Log layout, after the magic and the start time stamp:
+//	TICK		u8 kind, f64 deltaT
+//	QUEUE		u8 kind, u8 priority, u32 type, f64 stamp, u32 size, payload
+//	TRIGGER		u8 kind, u32 type, f64 stamp, u32 size, payload
+//	QUEUEAT		u8 kind, u8 priority, f64 time, u32 type, f64 stamp, u32 size, payload
+//	POST		u8 kind, u8 priority, u32 type, f64 stamp, u32 size, payload
+const char MessageRecorder::MAGIC[8] = { 'E', 'N', 'G', 'R', 'E', 'C', '0', '1' };
+
+//========================================================================
+// MessageRecorder implemenation
+//========================================================================
+
+MessageRecorder::MessageRecorder(Scope scope)
+	: file_(0), codecs_(0), scope_(scope), stopping_(false), failed_(false),
+	  message_count_(0), tick_count_(0) {}
+
+
+MessageRecorder::~MessageRecorder() {
+	close();
+}
+
+
+//-----------------------------------------------------------------------
+// open - Public MessageRecorder
+// Description
+//		Creates the log, writes its header and starts the writer thread.
+//		A log already open is closed first.
+//
+// Arguments:	path - the file to write, replaced if it exists
+//				startTime - the engine's time stamp as the recording starts
+//				codecs - the payload codecs, 0 to log no payloads
+// Returns:		false if the file couldn't be opened
+//-----------------------------------------------------------------------
+bool MessageRecorder::open(const char* path, const double& startTime, const MessageCodecs* codecs) {
+	close();
+
+	file_ = std::fopen(path, "wb");
+	if (!file_)
+		return false;
+
+	codecs_ = codecs;
+	stopping_ = false;
+	failed_ = false;
+	message_count_ = 0;
+	tick_count_ = 0;
+
+	buffer_.clear();
+	buffer_.reserve(FLUSHSIZE);
+	buffer_.insert(buffer_.end(), MAGIC, MAGIC + sizeof(MAGIC));
+	append(startTime);
+
+	writer_ = std::thread(&MessageRecorder::writerLoop, this);
+	return true;
+}
+
+
+//-----------------------------------------------------------------------
+// close - Public MessageRecorder
+// Description
+//		Hands the last buffer to the writer, waits for everything to be
+//		written and closes the file.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessageRecorder::close() {
+	if (!file_)
+		return;
+
+	if (!buffer_.empty())
+		handOff();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	wake_.notify_one();
+	writer_.join();
+
+	if (std::fclose(file_) != 0)
+		failed_ = true;
+	file_ = 0;
+	full_.clear();
+}
+
+
+bool MessageRecorder::hasFailed() {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return failed_;
+}
+
+
+void MessageRecorder::recordQueue(const Message& msg, unsigned char priority) {
+	if (!file_)
+		return;
+	buffer_.push_back((char)QUEUE);
+	buffer_.push_back((char)priority);
+	appendMessage(msg);
+}
+
+
+void MessageRecorder::recordTrigger(const Message& msg) {
+	if (!file_)
+		return;
+	buffer_.push_back((char)TRIGGER);
+	appendMessage(msg);
+}
+
+
+void MessageRecorder::recordQueueAt(const Message& msg, unsigned char priority, const double& time) {
+	if (!file_)
+		return;
+	buffer_.push_back((char)QUEUEAT);
+	buffer_.push_back((char)priority);
+	append(time);
+	appendMessage(msg);
+}
+
+
+void MessageRecorder::recordPost(const Message& msg, unsigned char priority) {
+	if (!file_)
+		return;
+	buffer_.push_back((char)POST);
+	buffer_.push_back((char)priority);
+	appendMessage(msg);
+}
+
+
+void MessageRecorder::recordTick(const double& deltaT) {
+	if (!file_)
+		return;
+	buffer_.push_back((char)TICK);
+	append(deltaT);
+	++tick_count_;
+	if (buffer_.size() >= FLUSHSIZE)
+		handOff();
+}
+
+
+//-----------------------------------------------------------------------
+// appendMessage - Private MessageRecorder
+// Description
+//		Appends the type, the time stamp and the payload of a message.
+//		The payload size is filled in once its codec has written it.
+//
+// Arguments:	msg - the message being recorded
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessageRecorder::appendMessage(const Message& msg) {
+	append((unsigned int)msg.getType());
+	append(msg.getTimeStamp());
+
+	std::size_t sizeAt = buffer_.size();
+	append((unsigned int)0);
+	const MessageCodecs::Codec* codec = codecs_ ? codecs_->find(msg.getType()) : 0;
+	if (codec && codec->write) {
+		codec->write(msg, buffer_);
+		unsigned int size = (unsigned int)(buffer_.size() - sizeAt - sizeof(unsigned int));
+		std::memcpy(&buffer_[sizeAt], &size, sizeof(size));
+	}
+
+	++message_count_;
+	if (buffer_.size() >= FLUSHSIZE)
+		handOff();
+}
+
+
+//-----------------------------------------------------------------------
+// handOff - Private MessageRecorder
+// Description
+//		Queues the buffer for the writer and carries on in a spare one.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessageRecorder::handOff() {
+	std::vector<char> next;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		full_.push_back(std::vector<char>());
+		full_.back().swap(buffer_);
+		if (!spare_.empty()) {
+			next.swap(spare_.back());
+			spare_.pop_back();
+		}
+	}
+	wake_.notify_one();
+
+	buffer_.swap(next);
+	buffer_.clear();
+	if (buffer_.capacity() < FLUSHSIZE)
+		buffer_.reserve(FLUSHSIZE);
+}
+
+
+//-----------------------------------------------------------------------
+// writerLoop - Private MessageRecorder
+// Description
+//		The writer thread.  Writes the full buffers in order until close()
+//		asks it to stop and nothing is left.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void MessageRecorder::writerLoop() {
+	std::vector<std::vector<char> > writing;
+	std::unique_lock<std::mutex> lock(mutex_);
+	for (;;) {
+		wake_.wait(lock, [this] { return !full_.empty() || stopping_; });
+		if (full_.empty())
+			break;
+
+		writing.swap(full_);
+		lock.unlock();
+		bool ok = true;
+		for (std::size_t i = 0; i < writing.size(); ++i) {
+			if (!writing[i].empty() && std::fwrite(&writing[i][0], 1, writing[i].size(), file_) != writing[i].size())
+				ok = false;
+		}
+		lock.lock();
+
+		if (!ok)
+			failed_ = true;
+		for (std::size_t i = 0; i < writing.size(); ++i) {
+			if (spare_.size() < SPAREBUFFERS)
+				spare_.push_back(std::move(writing[i]));
+		}
+		writing.clear();
+	}
+}
+
+
+
+//========================================================================
+// MessageReplay implemenation
+//========================================================================
+
+//-----------------------------------------------------------------------
+// load - Public MessageReplay
+// Description
+//		Reads a whole log into memory and checks its header.
+//
+// Arguments:	path - a log written by a MessageRecorder
+//				codecs - the payload codecs, 0 to replay plain Messages
+// Returns:		false if the file can't be read or isn't a log
+//-----------------------------------------------------------------------
+bool MessageReplay::load(const char* path, const MessageCodecs* codecs) {
+	log_.clear();
+	codecs_ = codecs;
+	corrupt_ = false;
+
+	std::FILE* file = std::fopen(path, "rb");
+	if (!file)
+		return false;
+	char chunk[64 * 1024];
+	std::size_t read;
+	while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0)
+		log_.insert(log_.end(), chunk, chunk + read);
+	bool ok = !std::ferror(file);
+	std::fclose(file);
+
+	if (!ok || log_.size() < sizeof(MessageRecorder::MAGIC) + sizeof(double)
+		|| std::memcmp(&log_[0], MessageRecorder::MAGIC, sizeof(MessageRecorder::MAGIC)) != 0) {
+		log_.clear();
+		return false;
+	}
+	std::memcpy(&log_start_, &log_[sizeof(MessageRecorder::MAGIC)], sizeof(double));
+	rewind();
+	return true;
+}
+
+
+void MessageReplay::rewind() {
+	cursor_ = log_.empty() ? 0 : sizeof(MessageRecorder::MAGIC) + sizeof(double);
+	started_ = false;
+	message_count_ = 0;
+	tick_count_ = 0;
+}
+
+
+//-----------------------------------------------------------------------
+// step - Public MessageReplay
+// Description
+//		Queues and triggers the messages recorded ahead of the next tick,
+//		then runs that tick with its recorded deltaT.  The first step
+//		lines the recorded time stamps up with the engine's clock.
+//
+// Arguments:	engine - the engine to replay into
+// Returns:		true if a tick was run
+//-----------------------------------------------------------------------
+bool MessageReplay::step(Engine& engine) {
+	if (!started_) {
+		time_offset_ = engine.getTimeStamp() - log_start_;
+		started_ = true;
+	}
+
+	while (!isDone()) {
+		unsigned char kind;
+		read(kind);
+		bool ok;
+		switch (kind) {
+		case MessageRecorder::TICK: {
+			double deltaT;
+			ok = read(deltaT);
+			if (ok) {
+				++tick_count_;
+				engine.tick(deltaT);
+				return true;
+			}
+			break;
+		}
+		case MessageRecorder::QUEUE:
+		case MessageRecorder::TRIGGER:
+		case MessageRecorder::QUEUEAT:
+		case MessageRecorder::POST:
+			ok = replayMessage(engine, (MessageRecorder::Record)kind);
+			break;
+		default:
+			ok = false;
+		}
+		if (!ok)
+			break;
+	}
+
+	// Anything short of a whole record left is a damaged log
+	if (!isDone()) {
+		corrupt_ = true;
+		cursor_ = log_.size();
+	}
+	return false;
+}
+
+
+unsigned long MessageReplay::run(Engine& engine) {
+	unsigned long ticks = 0;
+	while (step(engine))
+		++ticks;
+	return ticks;
+}
+
+
+//-----------------------------------------------------------------------
+// replayMessage - Private MessageReplay
+// Description
+//		Rebuilds one recorded message and queues, schedules or triggers it.
+//
+// Arguments:	engine - the engine to replay into
+//				kind - QUEUE, TRIGGER, QUEUEAT or POST
+// Returns:		false if the record runs past the end of the log
+//-----------------------------------------------------------------------
+bool MessageReplay::replayMessage(Engine& engine, MessageRecorder::Record kind) {
+	unsigned char priority = Engine::NORMAL;
+	double time = 0.0;
+	unsigned int type;
+	double stamp;
+	unsigned int size;
+	if ((kind != MessageRecorder::TRIGGER && !read(priority)) || (kind == MessageRecorder::QUEUEAT && !read(time))
+		|| !read(type) || !read(stamp) || !read(size)
+		|| log_.size() - cursor_ < size || priority >= Engine::PRIORITYCOUNT)
+		return false;
+	const char* payload = size ? &log_[cursor_] : 0;
+	cursor_ += size;
+	stamp += time_offset_;
+
+	const MessageCodecs::Codec* codec = codecs_ ? codecs_->find(type) : 0;
+	Message* msg = codec && codec->read ? codec->read(engine, stamp, payload, size)
+		: engine.createMessage<Message>(type, stamp);
+	if (!msg)
+		return false;
+
+	++message_count_;
+	if (kind == MessageRecorder::QUEUE)
+		engine.queueMessage(msg, (Engine::MsgPriority)priority);
+	else if (kind == MessageRecorder::QUEUEAT)
+		engine.queueMessageAt(msg, time + time_offset_, (Engine::MsgPriority)priority);
+	else if (kind == MessageRecorder::POST)
+		engine.replayInput(msg, (Engine::MsgPriority)priority);
+	else {
+		engine.triggerMessage(*msg);
+		MessagePool::release(msg);
+	}
+	return true;
+}
+
+} // namespace engine
@@ -0,0 +1,218 @@
+/*=========================================================================
+/ James McCormick - MessageRecorder.h
+/ Recording the Engine's message stream and playing it back
+/==========================================================================*/
+
+#ifndef _MESSAGERECORDER_
+#define _MESSAGERECORDER_
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "Engine.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// MessageCodecs
+// How the payload of each message type is written to a log and read
+// back.  A type without a codec is logged with no payload and replayed
+// as a plain Message, so every type a listener casts down to a
+// TypedMessage needs one.
+class MessageCodecs {
+public:
+	// Appends the payload of msg to out
+	typedef std::function<void (const Message& msg, std::vector<char>& out)> Writer;
+	// A pooled message with the payload in data, 0 if it can't be decoded
+	typedef std::function<Message* (Engine& engine, const double& stamp, const char* data, std::size_t size)> Reader;
+
+	struct Codec {
+		Writer write;
+		Reader read;
+	};
+
+private:
+	std::unordered_map<MessageType, Codec> codecs_;
+
+public:
+	void add(MessageType type, const Writer& write, const Reader& read) {
+		Codec codec = { write, read };
+		codecs_[type] = codec;
+	}
+
+	// A TypedMessage<Payload> copied byte for byte, for payloads without pointers
+	template <class Payload>
+	void addPayload() {
+		static_assert(std::is_trivially_copyable<Payload>::value, "Payload needs a codec of its own");
+		add(MessageTypeOf<Payload>::value,
+			[](const Message& msg, std::vector<char>& out) {
+				const Payload& payload = static_cast<const TypedMessage<Payload>&>(msg).getPayload();
+				const char* bytes = reinterpret_cast<const char*>(&payload);
+				out.insert(out.end(), bytes, bytes + sizeof(Payload));
+			},
+			[](Engine& engine, const double& stamp, const char* data, std::size_t size) -> Message* {
+				if (size != sizeof(Payload))
+					return 0;
+				TypedMessage<Payload>* msg = engine.createMessage<TypedMessage<Payload> >(stamp);
+				std::memcpy(&msg->getPayload(), data, sizeof(Payload));
+				return msg;
+			});
+	}
+
+	const Codec* find(MessageType type) const {
+		std::unordered_map<MessageType, Codec>::const_iterator it = codecs_.find(type);
+		return it != codecs_.end() ? &it->second : 0;
+	}
+};
+
+
+//-----------------------------------------------------------------------
+// MessageRecorder
+// Logs the messages handed to queueMessage() and triggerMessage() and the
+// deltaT of every tick.  By default only the inputs are logged, the
+// messages sent between ticks and those posted from other threads.  What
+// the states and listeners send from inside a tick is left out since a
+// replay through the same code sends it again.  ALL logs every message,
+// for replaying into an engine with only the listeners under test.
+//
+// Records are appended to a buffer on the engine's thread, full buffers
+// are written out by a thread of the recorder's own.  The log is in the
+// machine's byte order.
+class MessageRecorder {
+public:
+	enum Scope {
+		INPUTS,
+		ALL
+	};
+
+	// The kinds of record in a log
+	enum Record {
+		TICK,
+		QUEUE,
+		TRIGGER,
+		QUEUEAT,
+		POST							// posted from another thread or carried by an input channel
+	};
+
+private:
+	static const std::size_t FLUSHSIZE = 64 * 1024;		// buffer size handed to the writer
+	static const std::size_t SPAREBUFFERS = 4;
+
+	std::FILE* file_;
+	const MessageCodecs* codecs_;
+	Scope scope_;
+	std::vector<char> buffer_;					// engine thread only
+
+	std::thread writer_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::vector<std::vector<char> > full_;		// waiting for the writer
+	std::vector<std::vector<char> > spare_;		// written out, kept for the capacity
+	bool stopping_;
+	bool failed_;								// a write failed, set by the writer
+
+	unsigned long message_count_;
+	unsigned long tick_count_;
+
+	MessageRecorder(const MessageRecorder&);
+	MessageRecorder& operator=(const MessageRecorder&);
+
+	void appendMessage(const Message& msg);
+	void handOff();
+	void writerLoop();
+
+	template <class T>
+	void append(const T& value) {
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		buffer_.insert(buffer_.end(), bytes, bytes + sizeof(T));
+	}
+
+public:
+	static const char MAGIC[8];
+
+	explicit MessageRecorder(Scope scope = INPUTS);
+	~MessageRecorder();
+
+	// Starts a new log at path.  startTime is the engine's time stamp at
+	// the start, the replay moves message time stamps by the difference
+	// to its own.  The codecs have to outlive the recording.
+	bool open(const char* path, const double& startTime, const MessageCodecs* codecs = 0);
+	// Writes out what is buffered and closes the log
+	void close();
+	bool isOpen() const { return file_ != 0; }
+	bool hasFailed();
+
+	Scope getScope() const { return scope_; }
+	unsigned long getMessageCount() const { return message_count_; }
+	unsigned long getTickCount() const { return tick_count_; }
+
+	// Called by the Engine
+	void recordQueue(const Message& msg, unsigned char priority);
+	void recordTrigger(const Message& msg);
+	void recordQueueAt(const Message& msg, unsigned char priority, const double& time);
+	void recordPost(const Message& msg, unsigned char priority);
+	void recordTick(const double& deltaT);
+};
+
+
+//-----------------------------------------------------------------------
+// MessageReplay
+// Feeds a log from a MessageRecorder back through an Engine.  The whole
+// log is read into memory up front, so a replay used as a benchmark
+// workload does no file reads while it runs.  Each step() queues and
+// triggers one tick's worth of messages then calls tick() with the
+// recorded deltaT.  Posted and channel messages are handed to the tick
+// to queue where it drains its inputs, after the messages due that tick,
+// as they were when recorded.
+class MessageReplay {
+private:
+	std::vector<char> log_;
+	std::size_t cursor_;
+	const MessageCodecs* codecs_;
+	double log_start_;
+	double time_offset_;				// replay time minus recorded time, set by the first step
+	bool started_;
+	bool corrupt_;
+
+	unsigned long message_count_;
+	unsigned long tick_count_;
+
+	template <class T>
+	bool read(T& value) {
+		if (log_.size() - cursor_ < sizeof(T))
+			return false;
+		std::memcpy(&value, &log_[cursor_], sizeof(T));
+		cursor_ += sizeof(T);
+		return true;
+	}
+
+	bool replayMessage(Engine& engine, MessageRecorder::Record kind);
+
+public:
+	MessageReplay() : cursor_(0), codecs_(0), log_start_(0.0), time_offset_(0.0), started_(false),
+		corrupt_(false), message_count_(0), tick_count_(0) {}
+
+	// The codecs have to outlive the replay
+	bool load(const char* path, const MessageCodecs* codecs = 0);
+	void rewind();
+
+	// Replays one tick, false once the log is used up
+	bool step(Engine& engine);
+	// Replays the rest of the log, returns the ticks run
+	unsigned long run(Engine& engine);
+
+	bool isDone() const { return cursor_ >= log_.size(); }
+	bool isCorrupt() const { return corrupt_; }
+	unsigned long getMessageCount() const { return message_count_; }
+	unsigned long getTickCount() const { return tick_count_; }
+};
+
+} // namespace engine
+
+#endif // _MESSAGERECORDER_
@@ -0,0 +1,86 @@
+/*=========================================================================
+/ James McCormick - MessageStats.h
+/ Per message type counters for the Engine message bus
+/==========================================================================*/
+
+#ifndef _MESSAGESTATS_
+#define _MESSAGESTATS_
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+#include "Message.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// MessageStats
+// What the bus did with one message type since the stats were last reset.
+struct MessageStats {
+	unsigned long queued;			// accepted by queueMessage
+	unsigned long triggered;		// passes through triggerMessage, queued or direct
+	unsigned long consumed;			// triggers some listener consumed
+	unsigned long no_listener;		// rejected by queueMessage or triggered with no listener
+	unsigned long requeued;			// came back unconsumed and went round again
+	unsigned long coalesced;		// replaced in the queue by a newer message with the same key
+	unsigned long long deliveries;	// listener calls, deliveries / triggered is the fan out
+	long long handler_time;			// nanoseconds spent inside the listeners, less the time of
+									// the messages they triggered, which goes to those types
+	unsigned long waits;			// queued messages dispatched
+	double wait_total;				// dispatch time minus time stamp, summed over waits
+	double wait_max;
+
+	MessageStats() : queued(0), triggered(0), consumed(0), no_listener(0), requeued(0), coalesced(0),
+		deliveries(0), handler_time(0), waits(0), wait_total(0.0), wait_max(0.0) {}
+
+	double getAverageFanOut() const { return triggered ? (double)deliveries / triggered : 0.0; }
+	double getAverageHandlerTime() const { return triggered ? handler_time * 1e-9 / triggered : 0.0; }
+	double getAverageWait() const { return waits ? wait_total / waits : 0.0; }
+};
+
+
+//-----------------------------------------------------------------------
+// MessageStatsTable
+// Same layout as the ListenerTable, dense below the limit and hashed
+// above it, so the bookkeeping on each message is an array index.
+class MessageStatsTable {
+private:
+	static const std::size_t DENSELIMIT = 256;
+
+	std::vector<MessageStats> dense_;
+	std::unordered_map<MessageType, MessageStats> sparse_;
+
+public:
+	MessageStats& get(const MessageType& type) {
+		if (type < DENSELIMIT) {
+			if (type >= dense_.size())
+				dense_.resize(type + 1);
+			return dense_[type];
+		}
+		return sparse_[type];
+	}
+
+	// NULL if nothing was recorded for the type
+	const MessageStats* find(const MessageType& type) const {
+		if (type < DENSELIMIT)
+			return type < dense_.size() ? &dense_[type] : 0;
+		std::unordered_map<MessageType, MessageStats>::const_iterator itr = sparse_.find(type);
+		return itr == sparse_.end() ? 0 : &itr->second;
+	}
+
+	// func(MessageType, const MessageStats&) for every type with any activity
+	template <class Func>
+	void forEach(Func func) const {
+		for (std::size_t i = 0; i < dense_.size(); ++i)
+			if (dense_[i].queued || dense_[i].triggered || dense_[i].no_listener)
+				func(static_cast<MessageType>(i), dense_[i]);
+		for (auto& entry : sparse_)
+			func(entry.first, entry.second);
+	}
+
+	void clear() { dense_.clear(); sparse_.clear(); }
+};
+
+} // namespace engine
+
+#endif // _MESSAGESTATS_
@@ -0,0 +1,286 @@
+/*=========================================================================
+/ James McCormick - Profiler.cpp
+/ Per tick timing of the engine phases and systems
+/==========================================================================*/
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include "Profiler.h"
+
+namespace engine {
+
+namespace {
+	thread_local FrameProfiler* tls_current_profiler = 0;
+
+	std::size_t traceThreadId() {
+		return std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000;
+	}
+
+	const char* const PHASENAMES[FrameProfiler::PHASECOUNT] = {
+		"timer", "messages", "state change", "update", "render"
+	};
+
+	void writeJsonString(std::ostream& out, const char* s) {
+		out << '"';
+		for (; *s; ++s) {
+			if (*s == '"' || *s == '\\')
+				out << '\\';
+			out << *s;
+		}
+		out << '"';
+	}
+}
+
+//========================================================================
+// FrameProfiler implemenation
+//========================================================================
+
+FrameProfiler::FrameProfiler(std::size_t frames, std::size_t samplesPerFrame)
+	: frames_(frames > 0 ? frames : 1), samples_((frames > 0 ? frames : 1) * samplesPerFrame),
+	  samples_per_frame_(samplesPerFrame), frame_count_(0), current_(0), in_frame_(false),
+	  sample_cursor_(0), dropped_samples_(0) {}
+
+
+FrameProfiler* FrameProfiler::current() {
+	return tls_current_profiler;
+}
+
+
+void FrameProfiler::setCurrent(FrameProfiler* profiler) {
+	tls_current_profiler = profiler;
+}
+
+
+void FrameProfiler::reset() {
+	frame_count_ = 0;
+	current_ = 0;
+	in_frame_ = false;
+	dropped_samples_ = 0;
+}
+
+
+//-----------------------------------------------------------------------
+// beginFrame - Public FrameProfiler
+// Description
+//		Starts recording into the oldest slot of the ring.
+//
+// Arguments:	None.
+// Returns:		None.
+//-----------------------------------------------------------------------
+void FrameProfiler::beginFrame() {
+	Frame& frame = frames_[current_];
+	frame.start = C_Timer::now();
+	frame.duration = 0;
+	for (std::size_t i = 0; i < PHASECOUNT; ++i) {
+		frame.phase_start[i] = frame.start;
+		frame.phase[i] = 0;
+	}
+	frame.sample_count = 0;
+	frame.thread = traceThreadId();
+	sample_cursor_.store(0, std::memory_order_relaxed);
+	in_frame_ = true;
+}
+
+
+void FrameProfiler::endFrame() {
+	if (!in_frame_)
+		return;
+
+	Frame& frame = frames_[current_];
+	frame.duration = C_Timer::now() - frame.start;
+	frame.sample_count = std::min(sample_cursor_.load(std::memory_order_acquire), samples_per_frame_);
+
+	in_frame_ = false;
+	current_ = (current_ + 1) % frames_.size();
+	++frame_count_;
+}
+
+
+void FrameProfiler::recordPhase(Phase phase, long long start, long long duration) {
+	if (!in_frame_)
+		return;
+
+	Frame& frame = frames_[current_];
+	frame.phase_start[phase] = start;
+	frame.phase[phase] += duration;
+}
+
+
+//-----------------------------------------------------------------------
+// recordSample - Public FrameProfiler
+// Description
+//		Stores one timed span in the current frame, safe from any thread.
+//
+// Arguments:	category - what kind of work, e.g. "update"
+//				name - display name, has to outlive the profiler
+//				owner - what did the work, used to group the stats
+//				start - clock reading from C_Timer::now()
+//				duration - nanoseconds
+// Returns:		None.
+//-----------------------------------------------------------------------
+void FrameProfiler::recordSample(const char* category, const char* name, const void* owner,
+	long long start, long long duration) {
+	if (!in_frame_)
+		return;
+
+	std::size_t slot = sample_cursor_.fetch_add(1, std::memory_order_relaxed);
+	if (slot >= samples_per_frame_) {
+		dropped_samples_.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Sample& sample = samples_[current_ * samples_per_frame_ + slot];
+	sample.category = category;
+	sample.name = name;
+	sample.owner = owner;
+	sample.start = start;
+	sample.duration = duration;
+	sample.thread = traceThreadId();
+}
+
+
+void FrameProfiler::takeSamples(FrameProfiler& other) {
+	if (!in_frame_)
+		return;
+
+	if (other.recordedFrames() > 0) {
+		std::size_t slot = other.frameSlot(0);
+		const Frame& frame = other.frames_[slot];
+		const Sample* samples = &other.samples_[slot * other.samples_per_frame_];
+		for (std::size_t i = 0; i < frame.sample_count; ++i) {
+			std::size_t at = sample_cursor_.fetch_add(1, std::memory_order_relaxed);
+			if (at >= samples_per_frame_) {
+				dropped_samples_.fetch_add(frame.sample_count - i, std::memory_order_relaxed);
+				break;
+			}
+			samples_[current_ * samples_per_frame_ + at] = samples[i];
+		}
+		dropped_samples_.fetch_add(other.getDroppedSamples(), std::memory_order_relaxed);
+	}
+	other.reset();
+}
+
+
+std::size_t FrameProfiler::frameSlot(std::size_t age) const {
+	return (current_ + frames_.size() - 1 - age) % frames_.size();
+}
+
+
+FrameProfiler::Stats FrameProfiler::makeStats(std::vector<long long>& durations) {
+	Stats stats = { 0.0, 0.0, 0.0, 0.0, durations.size() };
+	if (durations.empty())
+		return stats;
+
+	std::sort(durations.begin(), durations.end());
+	long long total = 0;
+	for (auto d : durations)
+		total += d;
+
+	std::size_t p99 = (durations.size() * 99 + 99) / 100 - 1;
+	stats.min = durations.front() * 1e-9;
+	stats.max = durations.back() * 1e-9;
+	stats.avg = (double)total / durations.size() * 1e-9;
+	stats.p99 = durations[std::min(p99, durations.size() - 1)] * 1e-9;
+	return stats;
+}
+
+
+FrameProfiler::Stats FrameProfiler::getFrameStats() const {
+	std::vector<long long> durations;
+	for (std::size_t age = 0, count = recordedFrames(); age < count; ++age)
+		durations.push_back(frames_[frameSlot(age)].duration);
+	return makeStats(durations);
+}
+
+
+FrameProfiler::Stats FrameProfiler::getPhaseStats(Phase phase) const {
+	std::vector<long long> durations;
+	for (std::size_t age = 0, count = recordedFrames(); age < count; ++age)
+		durations.push_back(frames_[frameSlot(age)].phase[phase]);
+	return makeStats(durations);
+}
+
+
+//-----------------------------------------------------------------------
+// getSampleStats - Public FrameProfiler
+// Description
+//		Per frame totals for one owner, e.g. the update time of a system.
+//		Frames where the owner recorded nothing are left out.
+//
+// Arguments:	category - the category the samples were recorded under
+//				owner - the owner the samples were recorded with
+// Returns:		the stats in seconds
+//-----------------------------------------------------------------------
+FrameProfiler::Stats FrameProfiler::getSampleStats(const char* category, const void* owner) const {
+	std::vector<long long> durations;
+	for (std::size_t age = 0, count = recordedFrames(); age < count; ++age) {
+		std::size_t slot = frameSlot(age);
+		const Frame& frame = frames_[slot];
+
+		long long total = 0;
+		bool found = false;
+		for (std::size_t i = 0; i < frame.sample_count; ++i) {
+			const Sample& sample = samples_[slot * samples_per_frame_ + i];
+			if (sample.owner == owner && std::strcmp(sample.category, category) == 0) {
+				total += sample.duration;
+				found = true;
+			}
+		}
+		if (found)
+			durations.push_back(total);
+	}
+	return makeStats(durations);
+}
+
+
+//-----------------------------------------------------------------------
+// writeChromeTrace - Public FrameProfiler
+// Description
+//		Writes every frame still in the ring as complete ("X") events,
+//		oldest first.  Times are in microseconds.
+//
+// Arguments:	out - the stream to write the JSON to
+// Returns:		None.
+//-----------------------------------------------------------------------
+void FrameProfiler::writeChromeTrace(std::ostream& out) const {
+	std::ios::fmtflags flags = out.flags(std::ios::fixed);
+	std::streamsize precision = out.precision(3);
+
+	out << "{\"traceEvents\":[";
+	bool first = true;
+
+	for (std::size_t count = recordedFrames(), age = count; age-- > 0;) {
+		std::size_t slot = frameSlot(age);
+		const Frame& frame = frames_[slot];
+
+		out << (first ? "" : ",") << "\n{\"name\":\"tick\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":0,\"tid\":" << frame.thread
+			<< ",\"ts\":" << frame.start / 1000.0 << ",\"dur\":" << frame.duration / 1000.0 << "}";
+		first = false;
+
+		for (std::size_t p = 0; p < PHASECOUNT; ++p) {
+			if (frame.phase[p] == 0)
+				continue;
+			out << ",\n{\"name\":\"" << PHASENAMES[p] << "\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":0,\"tid\":" << frame.thread
+				<< ",\"ts\":" << frame.phase_start[p] / 1000.0 << ",\"dur\":" << frame.phase[p] / 1000.0 << "}";
+		}
+
+		for (std::size_t i = 0; i < frame.sample_count; ++i) {
+			const Sample& sample = samples_[slot * samples_per_frame_ + i];
+			out << ",\n{\"name\":";
+			writeJsonString(out, sample.name);
+			out << ",\"cat\":";
+			writeJsonString(out, sample.category);
+			out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << sample.thread
+				<< ",\"ts\":" << sample.start / 1000.0 << ",\"dur\":" << sample.duration / 1000.0
+				<< ",\"args\":{\"owner\":\"" << sample.owner << "\"}}";
+		}
+	}
+	out << "\n]}\n";
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+}  // namespace engine
@@ -0,0 +1,165 @@
+/*=========================================================================
+/ James McCormick - Profiler.h
+/ Per tick timing of the engine phases and systems
+/==========================================================================*/
+
+#ifndef _PROFILER_
+#define _PROFILER_
+
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+#include "Timer.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// FrameProfiler
+// Keeps the last N ticks in a ring.  Each tick records how long every
+// phase of Engine::tick() took plus a sample per system update and render.
+// Samples claim their slot with one atomic increment so systems running
+// on the job system can record at the same time, a tick that overflows
+// its sample slots drops the extra samples and counts them.
+//
+// Nothing here is compiled into the engine unless ENGINE_PROFILE is
+// defined, without it the macros at the bottom expand to nothing.
+class FrameProfiler {
+public:
+	enum Phase {
+		TIMER,
+		MESSAGES,
+		STATE_CHANGE,
+		UPDATE,
+		RENDER,
+		PHASECOUNT
+	};
+
+	// Durations in seconds
+	struct Stats {
+		double min;
+		double avg;
+		double p99;
+		double max;
+		std::size_t samples;
+	};
+
+private:
+	struct Sample {
+		const char* category;
+		const char* name;
+		const void* owner;
+		long long start;
+		long long duration;
+		std::size_t thread;
+	};
+
+	struct Frame {
+		long long start;
+		long long duration;
+		long long phase_start[PHASECOUNT];
+		long long phase[PHASECOUNT];
+		std::size_t sample_count;
+		std::size_t thread;					// trace thread id of the thread running tick()
+	};
+
+	std::vector<Frame> frames_;
+	std::vector<Sample> samples_;			// samples_per_frame_ slots for each frame
+	std::size_t samples_per_frame_;
+	std::size_t frame_count_;				// frames recorded since the last reset
+	std::size_t current_;					// slot of the frame being recorded
+	bool in_frame_;
+	std::atomic<std::size_t> sample_cursor_;
+	std::atomic<unsigned long> dropped_samples_;
+
+	FrameProfiler(const FrameProfiler&);
+	FrameProfiler& operator=(const FrameProfiler&);
+
+	std::size_t recordedFrames() const { return frame_count_ < frames_.size() ? frame_count_ : frames_.size(); }
+	std::size_t frameSlot(std::size_t age) const;	// age 0 is the newest finished frame
+	static Stats makeStats(std::vector<long long>& durations);
+
+public:
+	explicit FrameProfiler(std::size_t frames = 300, std::size_t samplesPerFrame = 256);
+
+	void beginFrame();
+	void endFrame();
+	void reset();
+
+	void recordPhase(Phase phase, long long start, long long duration);
+	void recordSample(const char* category, const char* name, const void* owner,
+		long long start, long long duration);
+	// Moves the samples of other's newest frame, keeping their threads, and
+	// its dropped count into the frame being recorded, then resets other.
+	// For a profiler recording on another thread, which must be idle.
+	// Outside a frame other is left as it is, for the next frame to take.
+	void takeSamples(FrameProfiler& other);
+
+	// Over the frames still in the ring
+	Stats getFrameStats() const;
+	Stats getPhaseStats(Phase phase) const;
+	Stats getSampleStats(const char* category, const void* owner) const;
+	unsigned long getDroppedSamples() const { return dropped_samples_.load(std::memory_order_relaxed); }
+
+	// Chrome trace event JSON, load it in chrome://tracing or Perfetto
+	void writeChromeTrace(std::ostream& out) const;
+
+	// The profiler the recording tick is writing into, per thread
+	static FrameProfiler* current();
+	static void setCurrent(FrameProfiler* profiler);
+};
+
+
+//-----------------------------------------------------------------------
+// Scoped recorders, a NULL profiler records nothing
+class ProfilePhaseScope {
+private:
+	FrameProfiler* profiler_;
+	FrameProfiler::Phase phase_;
+	long long start_;
+
+public:
+	ProfilePhaseScope(FrameProfiler* profiler, FrameProfiler::Phase phase)
+		: profiler_(profiler), phase_(phase), start_(profiler ? C_Timer::now() : 0) {}
+	~ProfilePhaseScope() {
+		if (profiler_)
+			profiler_->recordPhase(phase_, start_, C_Timer::now() - start_);
+	}
+};
+
+class ProfileScope {
+private:
+	FrameProfiler* profiler_;
+	const char* category_;
+	const char* name_;
+	const void* owner_;
+	long long start_;
+
+public:
+	ProfileScope(FrameProfiler* profiler, const char* category, const char* name, const void* owner)
+		: profiler_(profiler), category_(category), name_(name), owner_(owner),
+		  start_(profiler ? C_Timer::now() : 0) {}
+	~ProfileScope() {
+		if (profiler_)
+			profiler_->recordSample(category_, name_, owner_, start_, C_Timer::now() - start_);
+	}
+};
+//-----------------------------------------------------------------------
+
+} // namespace engine
+
+
+#define ENGINE_PROFILE_JOIN2(a, b) a##b
+#define ENGINE_PROFILE_JOIN(a, b) ENGINE_PROFILE_JOIN2(a, b)
+
+#ifdef ENGINE_PROFILE
+#define ENGINE_PROFILE_PHASE(phase) \
+	engine::ProfilePhaseScope ENGINE_PROFILE_JOIN(profile_phase_, __LINE__)(engine::FrameProfiler::current(), phase)
+#define ENGINE_PROFILE_SCOPE(profiler, category, name, owner) \
+	engine::ProfileScope ENGINE_PROFILE_JOIN(profile_scope_, __LINE__)(profiler, category, name, owner)
+#else
+#define ENGINE_PROFILE_PHASE(phase)
+#define ENGINE_PROFILE_SCOPE(profiler, category, name, owner)
+#endif
+
+#endif // _PROFILER_
@@ -0,0 +1,53 @@
+/*=========================================================================
+/ James McCormick - RenderSnapshot.h
+/ Double buffered render data handed from the update to the render
+/==========================================================================*/
+
+#ifndef _RENDERSNAPSHOT_
+#define _RENDERSNAPSHOT_
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// SnapshotBufferBase
+// What an EngineState swaps, see EngineState::addSnapshot()
+class SnapshotBufferBase {
+public:
+	virtual ~SnapshotBufferBase() {}
+	virtual void swap() = 0;
+};
+
+
+//-----------------------------------------------------------------------
+// SnapshotBuffer
+// Two copies of whatever a system's onRender needs from its onUpdate.
+// onUpdate writes the back copy, onRender reads the front one, and the
+// Engine swaps them between the two once the update is finished.  With
+// pipelined rendering onRender of one frame runs alongside onUpdate of
+// the next, each on its own copy, so neither side locks.
+//
+// The swap doesn't copy, after it back() holds the frame before last.
+// A system that only changes part of its data has to fill in the rest.
+template <class T>
+class SnapshotBuffer : public SnapshotBufferBase {
+private:
+	T buffers_[2];
+	unsigned int back_;
+
+	SnapshotBuffer(const SnapshotBuffer&);
+	SnapshotBuffer& operator=(const SnapshotBuffer&);
+
+public:
+	SnapshotBuffer() : back_(0) {}
+
+	// From onUpdate only
+	T& back() { return buffers_[back_]; }
+	// From onRender only
+	const T& front() const { return buffers_[back_ ^ 1]; }
+
+	void swap() { back_ ^= 1; }
+};
+
+} // namespace engine
+
+#endif // _RENDERSNAPSHOT_
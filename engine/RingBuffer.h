@@ -0,0 +1,92 @@
+/*=========================================================================
+/ James McCormick - RingBuffer.h
+/ A growable, contiguous FIFO queue
+/==========================================================================*/
+
+#ifndef _RINGBUFFER_
+#define _RINGBUFFER_
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// RingBuffer
+// FIFO storage in a single power of two sized array. Pushing only
+// allocates when the buffer is full, and a cleared buffer keeps its
+// capacity, so a queue that is drained every tick stops allocating once
+// it reaches its working size.
+template <class T>
+class RingBuffer {
+private:
+	std::vector<T> data_;
+	std::size_t head_;		// index of the front element
+	std::size_t size_;
+	std::size_t mask_;		// capacity - 1
+
+	void grow(std::size_t minCapacity) {
+		std::size_t capacity = data_.empty() ? 16 : data_.size();
+		while (capacity < minCapacity)
+			capacity <<= 1;
+		if (capacity == data_.size())
+			return;
+
+		std::vector<T> data(capacity);
+		for (std::size_t i = 0; i < size_; ++i)
+			data[i] = std::move(data_[(head_ + i) & mask_]);
+		data_.swap(data);
+		head_ = 0;
+		mask_ = capacity - 1;
+	}
+
+public:
+	RingBuffer() : head_(0), size_(0), mask_(0) {}
+
+	bool empty() const { return size_ == 0; }
+	std::size_t size() const { return size_; }
+	std::size_t capacity() const { return data_.size(); }
+
+	void reserve(std::size_t capacity) {
+		if (capacity > data_.size())
+			grow(capacity);
+	}
+
+	void push_back(const T& value) {
+		if (size_ == data_.size())
+			grow(size_ + 1);
+		data_[(head_ + size_) & mask_] = value;
+		++size_;
+	}
+
+	void pop_front() {
+		head_ = (head_ + 1) & mask_;
+		--size_;
+	}
+
+	void pop_front(std::size_t count) {
+		head_ = (head_ + count) & mask_;
+		size_ -= count;
+	}
+
+	T& front() { return data_[head_]; }
+	const T& front() const { return data_[head_]; }
+
+	// Index relative to the front of the queue
+	T& operator[](std::size_t i) { return data_[(head_ + i) & mask_]; }
+	const T& operator[](std::size_t i) const { return data_[(head_ + i) & mask_]; }
+
+	void clear() { head_ = 0; size_ = 0; }
+
+	void swap(RingBuffer& other) {
+		data_.swap(other.data_);
+		std::swap(head_, other.head_);
+		std::swap(size_, other.size_);
+		std::swap(mask_, other.mask_);
+	}
+};
+
+} // namespace engine
+
+#endif // _RINGBUFFER_
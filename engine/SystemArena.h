@@ -0,0 +1,83 @@
+/*=========================================================================
+/ James McCormick - SystemArena.h
+/ Contiguous storage for the systems a state owns
+/==========================================================================*/
+
+#ifndef _SYSTEMARENA_
+#define _SYSTEMARENA_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// SystemArena
+// Bump allocates objects back to back in large blocks, so systems
+// created together sit next to each other in memory.  Nothing is freed
+// on its own, every object is destroyed, newest first, when the arena
+// is.  Objects only need a virtual destructor in Base.
+template <class Base>
+class SystemArena {
+private:
+	static const std::size_t BLOCKSIZE = 16 * 1024;
+
+	struct Block {
+		char* data;
+		std::size_t size;
+		std::size_t used;
+	};
+	std::vector<Block> blocks_;
+	std::vector<Base*> objects_;			// in creation order
+
+	SystemArena(const SystemArena&);
+	SystemArena& operator=(const SystemArena&);
+
+	void* allocate(std::size_t size, std::size_t align) {
+		if (!blocks_.empty()) {
+			Block& block = blocks_.back();
+			std::size_t offset = (block.used + align - 1) & ~(align - 1);
+			if (offset + size <= block.size) {
+				block.used = offset + size;
+				return block.data + offset;
+			}
+		}
+
+		// operator new memory is aligned for any fundamental type
+		Block block;
+		block.size = size > BLOCKSIZE ? size : BLOCKSIZE;
+		block.data = static_cast<char*>(::operator new(block.size));
+		block.used = size;
+		blocks_.push_back(block);
+		return block.data;
+	}
+
+public:
+	SystemArena() {}
+	~SystemArena() { clear(); }
+
+	template <class T, class... Args>
+	T* create(Args&&... args) {
+		void* memory = allocate(sizeof(T), alignof(T));
+		T* object = new (memory) T(std::forward<Args>(args)...);
+		objects_.push_back(object);
+		return object;
+	}
+
+	std::size_t size() const { return objects_.size(); }
+
+	void clear() {
+		for (std::size_t i = objects_.size(); i-- > 0;)
+			objects_[i]->~Base();
+		objects_.clear();
+		for (auto& block : blocks_)
+			::operator delete(block.data);
+		blocks_.clear();
+	}
+};
+
+} // namespace engine
+
+#endif // _SYSTEMARENA_
@@ -3,59 +3,121 @@
 
 #include <chrono>
 
+#if defined(ENGINE_TIMER_TSC) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define ENGINE_TIMER_USE_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
 namespace engine {
 
+// Keeps everything in integer nanoseconds on a monotonic clock.  The clock
+// is read once per tick(), the double accessors convert the stored sample.
 class C_Timer {
 private:
-    typedef std::chrono::high_resolution_clock Clock;
-    static const long COUNTSPERSECOND = 1e9;
+    typedef std::chrono::steady_clock Clock;
+    static const long long NANOSPERSECOND = 1000000000LL;
 
     bool paused_;
 
-    Clock::time_point	base_time_,		// The base time of the timer.
-                        pause_time_,	// The time marker when the timer was paused
-                        prev_time_,		// The time during the last time step
-                        current_time_;
+    long long   base_time_,		// The base time of the timer.
+                pause_time_,	// The time marker when the timer was paused
+                prev_time_,		// The time during the last time step
+                current_time_;	// The time of the last tick()
+
+    long long pause_total_;	// The total time the timer was paused
+    long long delta_time_;	// The delta nanoseconds between ticks
 
-    std::chrono::nanoseconds pause_total_;	// The total time the timer was paused
-    std::chrono::nanoseconds delta_time_;	// The delta seconds between ticks
+    static inline long long clockNow() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+#ifdef ENGINE_TIMER_USE_TSC
+    // The TSC rate, measured against the steady clock the first time now() is called
+    struct TscCalibration {
+        unsigned long long tsc_base;
+        long long ns_base;
+        double ns_per_tick;
+
+        TscCalibration() {
+            long long ns0 = clockNow();
+            unsigned long long tsc0 = __rdtsc();
+            while (clockNow() - ns0 < 5000000)
+                ;
+            long long ns1 = clockNow();
+            unsigned long long tsc1 = __rdtsc();
+            tsc_base = tsc1;
+            ns_base = ns1;
+            ns_per_tick = (double)(ns1 - ns0) / (double)(tsc1 - tsc0);
+        }
+    };
+#endif
 
 public:
     // Constructor
-    C_Timer() : paused_(false), pause_total_(std::chrono::nanoseconds::zero()) {}
+    C_Timer() : paused_(false), base_time_(0), pause_time_(0), prev_time_(0), current_time_(0),
+        pause_total_(0), delta_time_(0) {}
     ~C_Timer() {}
 
-    // Gets time in seconds since Reset() was called
-    inline double getTime() {
+    // Raw clock reading in nanoseconds, for timing short spans of code.
+    // Built with ENGINE_TIMER_TSC on x86 it reads the time stamp counter
+    // instead, which needs a CPU with an invariant TSC.
+    static inline long long now() {
+#ifdef ENGINE_TIMER_USE_TSC
+        static const TscCalibration calibration;
+        return calibration.ns_base + (long long)((double)(long long)(__rdtsc() - calibration.tsc_base) * calibration.ns_per_tick);
+#else
+        return clockNow();
+#endif
+    }
+
+    // Nanoseconds since start() as of the last tick(), less the time paused
+    inline long long getTicks() const {
         // If we are paused, dont count the time since we have stopped
-        //	
+        //
         // -----*----------------*--------------*----------> Time
         //	d_baseTime		d_pauseTime	    d_currentTime
         if (paused_)
-            return (double)(pause_time_ - base_time_).count()/COUNTSPERSECOND;
+            return pause_time_ - base_time_ - pause_total_;
 
         // The (d_currentTime - d_baseTime) includes any paused time
         // So need to subract that out
         //						 |<---pause_total--->|
         // -----*----------------*-------------------*----------------*----> Time
         //	base_time		pause_time	           start()       current_time
-        else {
-            current_time_ = Clock::now();
-            return (double)(current_time_ - base_time_ - pause_total_).count()/COUNTSPERSECOND;
-        }
+        return current_time_ - base_time_ - pause_total_;
+    }
+
+    // Nanoseconds between the last two tick() calls
+    inline long long getDeltaTicks() const { return delta_time_; }
+
+    // Gets time in seconds since Reset() was called, as of the last tick()
+    inline double getTime() const {
+        return (double)getTicks() / NANOSPERSECOND;
     }
 
     // Gets the time in seconds since last tick()
-    inline double getDeltaTime() {
-        return (double)delta_time_.count()/COUNTSPERSECOND;
+    inline double getDeltaTime() const {
+        return (double)delta_time_ / NANOSPERSECOND;
+    }
+
+    // Reads the clock, for the time part way through a tick
+    inline double getTimeNow() const {
+        if (paused_)
+            return getTime();
+        return (double)(now() - base_time_ - pause_total_) / NANOSPERSECOND;
     }
 
     // Called to zero the timer and start the counters
     inline void start() {
-        current_time_ = Clock::now();
+        current_time_ = now();
         base_time_ = current_time_;
         prev_time_ = current_time_;
-        pause_total_ = std::chrono::nanoseconds::zero();
+        pause_total_ = 0;
+        delta_time_ = 0;
         paused_ = false;
     }
 
@@ -64,10 +126,10 @@ public:
         // If its already paused, don't do anything
         if (paused_) return;
         // Save the time we stopped at
-        pause_time_ = Clock::now();
+        pause_time_ = now();
         paused_ = true;
     }
-    
+
     inline void unpause() {
         if(!paused_) return;
         // We are resuming from a stopped state
@@ -76,25 +138,29 @@ public:
         //				|<--d_pauseTotal--->|
         // -------------*-------------------*--------------> Time
         //			d_pauseTime			 start()
-        current_time_ = Clock::now();
-        pause_total_ += (current_time_ - pause_time_);
-        
+        current_time_ = now();
+        pause_total_ += current_time_ - pause_time_;
+
         // Reset the previous time
         prev_time_ = current_time_;
         paused_ = false;
     }
 
-    // Called before the scene is updated, at the beginning of the sim loop
+    // Called before the scene is updated, at the beginning of the sim loop.
+    // The only clock read of a tick.
     inline void tick() {
-        // If paused do nothing
-        if (paused_) return;
+        // If paused no time passes
+        if (paused_) {
+            delta_time_ = 0;
+            return;
+        }
 
         // Calculate delta
         //
         //				|<----d_deltaTime----->|
         // -------------*----------------------*--------------> Time
         //			d_iPrevTime			      Tick()
-        current_time_ = Clock::now();
+        current_time_ = now();
         delta_time_ = current_time_ - prev_time_;
         prev_time_ = current_time_;
     }
@@ -0,0 +1,260 @@
+/*=========================================================================
+/ James McCormick - TimerWheel.h
+/ Hierarchical timer wheel for values due at a future tick
+/==========================================================================*/
+
+#ifndef _TIMERWHEEL_
+#define _TIMERWHEEL_
+
+#include <cstddef>
+#include <vector>
+
+namespace engine {
+
+// 0 is never a valid timer
+typedef unsigned long long TimerID;
+
+//-----------------------------------------------------------------------
+// TimerWheel
+// Four wheels of 256 slots, each slot of a wheel spanning a whole turn
+// of the one below.  A value goes into the lowest wheel its due tick
+// fits in and moves down a wheel each time the wheel below comes round,
+// so adding, cancelling and expiring are all O(1) however many values
+// are waiting.  Values further out than the top wheel sit in an overflow
+// list that is looked at once a turn of the top wheel.
+//
+// Values due on the same tick expire together but not necessarily in
+// the order they were added, the same adds always give the same order.
+// Nodes are kept in one vector and recycled, the wheel stops allocating
+// once it reaches its working size.  The slot lists are doubly linked so
+// a cancelled timer gives its node back at once, wherever it waits.
+template <class T>
+class TimerWheel {
+private:
+	static const unsigned int LEVELS = 4;
+	static const unsigned int SLOTBITS = 8;
+	static const unsigned int SLOTS = 1u << SLOTBITS;
+	static const unsigned int NONE = ~0u;
+
+	struct Node {
+		T value;
+		unsigned long long due;
+		unsigned int next;
+		unsigned int prev;
+		unsigned int generation;		// bumped when the node is freed, stale TimerIDs miss
+		unsigned int level;				// the wheel it is linked in, LEVELS for the overflow
+		bool live;						// true while waiting
+	};
+	struct List {
+		unsigned int head;
+		unsigned int tail;
+	};
+
+	std::vector<Node> nodes_;
+	unsigned int free_;
+	List slots_[LEVELS][SLOTS];
+	List overflow_;
+	std::size_t linked_[LEVELS + 1];	// nodes in each wheel's slots, the overflow last
+	unsigned long long current_;		// next tick to expire, everything before it has gone
+	std::size_t count_;					// live values
+
+	static void clearList(List& list) { list.head = NONE; list.tail = NONE; }
+
+	void append(List& list, unsigned int index) {
+		nodes_[index].next = NONE;
+		nodes_[index].prev = list.tail;
+		if (list.tail == NONE)
+			list.head = index;
+		else
+			nodes_[list.tail].next = index;
+		list.tail = index;
+	}
+
+	void place(unsigned int index) {
+		unsigned long long due = nodes_[index].due;
+		unsigned long long ahead = due - current_;
+		for (unsigned int level = 0; level < LEVELS; ++level) {
+			if (ahead < (1ull << (SLOTBITS * (level + 1)))) {
+				nodes_[index].level = level;
+				append(slots_[level][(due >> (SLOTBITS * level)) & (SLOTS - 1)], index);
+				++linked_[level];
+				return;
+			}
+		}
+		nodes_[index].level = LEVELS;
+		append(overflow_, index);
+		++linked_[LEVELS];
+	}
+
+	// Takes a waiting node out of the list place() put it in
+	void unlink(unsigned int index) {
+		Node& node = nodes_[index];
+		List& list = node.level == LEVELS ? overflow_
+			: slots_[node.level][(node.due >> (SLOTBITS * node.level)) & (SLOTS - 1)];
+		if (node.prev == NONE)
+			list.head = node.next;
+		else
+			nodes_[node.prev].next = node.next;
+		if (node.next == NONE)
+			list.tail = node.prev;
+		else
+			nodes_[node.next].prev = node.prev;
+		--linked_[node.level];
+	}
+
+	void freeNode(unsigned int index) {
+		Node& node = nodes_[index];
+		node.value = T();
+		++node.generation;
+		node.next = free_;
+		free_ = index;
+	}
+
+	// Spreads a slot of a higher wheel over the wheels below it
+	void cascade(List& list, unsigned int level) {
+		unsigned int index = list.head;
+		clearList(list);
+		while (index != NONE) {
+			unsigned int next = nodes_[index].next;
+			--linked_[level];
+			place(index);
+			index = next;
+		}
+	}
+
+public:
+	TimerWheel() : free_(NONE), current_(0), count_(0) {
+		for (unsigned int level = 0; level < LEVELS; ++level)
+			for (unsigned int slot = 0; slot < SLOTS; ++slot)
+				clearList(slots_[level][slot]);
+		clearList(overflow_);
+		for (unsigned int level = 0; level <= LEVELS; ++level)
+			linked_[level] = 0;
+	}
+
+	std::size_t size() const { return count_; }
+	bool empty() const { return count_ == 0; }
+	unsigned long long getCurrentTick() const { return current_; }
+
+	// A due tick already expired is moved up to getCurrentTick()
+	TimerID add(const T& value, unsigned long long due) {
+		unsigned int index;
+		if (free_ != NONE) {
+			index = free_;
+			free_ = nodes_[index].next;
+		}
+		else {
+			index = (unsigned int)nodes_.size();
+			Node node = Node();
+			node.generation = 1;
+			nodes_.push_back(node);
+		}
+
+		Node& node = nodes_[index];
+		node.value = value;
+		node.due = due < current_ ? current_ : due;
+		node.live = true;
+		place(index);
+		++count_;
+		return ((TimerID)node.generation << 32) | (index + 1);
+	}
+
+	// Hands back the value of a timer that hasn't expired yet
+	bool cancel(TimerID id, T& value) {
+		unsigned int index = (unsigned int)(id & 0xFFFFFFFFu) - 1;
+		if (id == 0 || index >= nodes_.size())
+			return false;
+		Node& node = nodes_[index];
+		if (!node.live || node.generation != (unsigned int)(id >> 32))
+			return false;
+
+		value = node.value;
+		node.live = false;
+		unlink(index);
+		freeNode(index);
+		--count_;
+		return true;
+	}
+
+	// Expires everything due up to and including tick now, in due order.
+	// func is called with each value, it must not add to or cancel from
+	// the wheel.
+	template <class Func>
+	void advance(unsigned long long now, Func func) {
+		while (current_ <= now) {
+			// Nothing waiting, no need to walk the slots
+			if (count_ == 0) {
+				current_ = now + 1;
+				return;
+			}
+
+			// With the lower wheels empty, skip to where the lowest wheel
+			// holding anything next comes round
+			if (!linked_[0]) {
+				unsigned int level = 1;
+				while (level < LEVELS && !linked_[level])
+					++level;
+				unsigned long long span = 1ull << (SLOTBITS * level);
+				unsigned long long next = (current_ + span - 1) & ~(span - 1);
+				if (next > now) {
+					current_ = now + 1;
+					return;
+				}
+				current_ = next;
+			}
+
+			// As a wheel comes round the next slot of the wheel above comes down
+			if ((current_ & (SLOTS - 1)) == 0 && current_ != 0) {
+				unsigned int level = 1;
+				while (level < LEVELS && ((current_ >> (SLOTBITS * level)) & (SLOTS - 1)) == 0)
+					++level;
+				if (level == LEVELS)
+					cascade(overflow_, LEVELS);
+				for (unsigned int l = (level < LEVELS ? level : LEVELS - 1); l >= 1; --l)
+					cascade(slots_[l][(current_ >> (SLOTBITS * l)) & (SLOTS - 1)], l);
+			}
+
+			List& slot = slots_[0][current_ & (SLOTS - 1)];
+			unsigned int index = slot.head;
+			clearList(slot);
+			while (index != NONE) {
+				unsigned int next = nodes_[index].next;
+				--linked_[0];
+				--count_;
+				nodes_[index].live = false;
+				func(nodes_[index].value);
+				freeNode(index);
+				index = next;
+			}
+			++current_;
+		}
+	}
+
+	// Hands every waiting value to func and empties the wheel, the clock
+	// goes back to tick 0.  The nodes are kept and their generations
+	// bumped, so no TimerID from before the clear matches a later timer.
+	template <class Func>
+	void clear(Func func) {
+		for (std::size_t i = 0; i < nodes_.size(); ++i) {
+			if (nodes_[i].live)
+				func(nodes_[i].value);
+		}
+		free_ = NONE;
+		for (std::size_t i = nodes_.size(); i-- > 0; ) {
+			nodes_[i].live = false;
+			freeNode((unsigned int)i);
+		}
+		for (unsigned int level = 0; level < LEVELS; ++level)
+			for (unsigned int slot = 0; slot < SLOTS; ++slot)
+				clearList(slots_[level][slot]);
+		clearList(overflow_);
+		for (unsigned int level = 0; level <= LEVELS; ++level)
+			linked_[level] = 0;
+		current_ = 0;
+		count_ = 0;
+	}
+};
+
+} // namespace engine
+
+#endif // _TIMERWHEEL_
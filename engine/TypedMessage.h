@@ -0,0 +1,148 @@
+/*=========================================================================
+/ James McCormick - TypedMessage.h
+/ Messages with an inline payload and statically typed handlers
+/==========================================================================*/
+
+#ifndef _TYPEDMESSAGE_
+#define _TYPEDMESSAGE_
+
+#include <functional>
+#include <utility>
+#include <vector>
+#include "ListenerTable.h"
+#include "Message.h"
+
+namespace engine {
+
+//-----------------------------------------------------------------------
+// MessageTypeOf
+// The message type id of a payload.  By default it is the payload's
+// MESSAGE_TYPE constant, specialize this for payloads you can't change.
+// Once a type id is used with a payload, every message queued with that
+// id has to be a TypedMessage of that payload.
+template <class Payload>
+struct MessageTypeOf {
+	// An enumerator rather than a static member so it never needs a definition
+	enum : MessageType { value = Payload::MESSAGE_TYPE };
+};
+
+
+//-----------------------------------------------------------------------
+// TypedMessage
+// A message carrying its payload inline.  Old style MessageListeners on
+// the same type can still static_cast to this to read the payload.
+template <class Payload>
+class TypedMessage : public Message {
+private:
+	Payload payload_;
+
+public:
+	template <class... Args>
+	explicit TypedMessage(const double& stamp, Args&&... args)
+		: Message(MessageTypeOf<Payload>::value, stamp), payload_(std::forward<Args>(args)...) {}
+
+	const Payload& getPayload() const { return payload_; }
+	Payload& getPayload() { return payload_; }
+};
+
+
+//-----------------------------------------------------------------------
+// TypedHandlerList
+// The Engine::subscribe<Payload>() handlers for one message type.
+typedef unsigned int SubscriptionID;		// 0 is never a valid subscription
+
+template <class Payload>
+class TypedHandlerList : public TypedHandlerListBase {
+public:
+	typedef std::function<bool (const Payload&)> Handler;
+
+private:
+	struct Entry {
+		SubscriptionID id;			// 0 once unsubscribed, until the list compacts
+		Handler handler;
+	};
+	std::vector<Entry> handlers_;
+	std::vector<Entry> added_;		// subscribed during a dispatch, joins handlers_ after it
+	SubscriptionID next_id_;
+	unsigned int dispatch_depth_;
+	bool has_removed_;
+
+	static bool dispatchTyped(TypedHandlerListBase* base, const Message& msg) {
+		TypedHandlerList* self = static_cast<TypedHandlerList*>(base);
+		const Payload& payload = static_cast<const TypedMessage<Payload>&>(msg).getPayload();
+
+		// The handlers don't move while a dispatch runs, so a handler can
+		// subscribe and unsubscribe from inside its own call.  Changes land
+		// once the outermost dispatch ends.
+		bool consumed = false;
+		++self->dispatch_depth_;
+		for (std::size_t i = 0; i < self->handlers_.size(); ++i)
+			if (self->handlers_[i].id && self->handlers_[i].handler(payload))
+				consumed = true;
+		if (--self->dispatch_depth_ == 0 && (self->has_removed_ || !self->added_.empty()))
+			self->compact();
+		return consumed;
+	}
+
+	void compact() {
+		std::size_t kept = 0;
+		for (std::size_t i = 0; i < handlers_.size(); ++i)
+			if (handlers_[i].id)
+				std::swap(handlers_[kept++], handlers_[i]);
+		handlers_.resize(kept);
+		has_removed_ = false;
+
+		for (std::size_t i = 0; i < added_.size(); ++i)
+			if (added_[i].id)
+				handlers_.push_back(std::move(added_[i]));
+		added_.clear();
+	}
+
+public:
+	TypedHandlerList() : TypedHandlerListBase(&dispatchTyped, payloadTag()), next_id_(1),
+		dispatch_depth_(0), has_removed_(false) {}
+
+	static const void* payloadTag() {
+		static const char tag = 0;
+		return &tag;
+	}
+
+	SubscriptionID add(const Handler& handler) {
+		Entry entry = { next_id_++, handler };
+		if (next_id_ == 0)
+			next_id_ = 1;
+		(dispatch_depth_ ? added_ : handlers_).push_back(entry);
+		++handler_count_;
+		return entry.id;
+	}
+
+	bool remove(SubscriptionID id) {
+		if (id == 0)
+			return false;
+		for (std::size_t i = 0; i < added_.size(); ++i) {
+			if (added_[i].id == id) {
+				added_[i].id = 0;
+				--handler_count_;
+				return true;
+			}
+		}
+		for (std::size_t i = 0; i < handlers_.size(); ++i) {
+			if (handlers_[i].id == id) {
+				--handler_count_;
+				if (dispatch_depth_) {
+					handlers_[i].id = 0;
+					has_removed_ = true;
+				}
+				else
+					handlers_.erase(handlers_.begin() + i);
+				return true;
+			}
+		}
+		return false;
+	}
+};
+//-----------------------------------------------------------------------
+
+} // namespace engine
+
+#endif // _TYPEDMESSAGE_